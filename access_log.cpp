@@ -0,0 +1,254 @@
+#include "h/access_log.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <stdexcept>
+
+
+static size_t roundUpToPowerOfTwo(size_t n) {
+    size_t result = 2;
+    while (result < n)
+        result <<= 1;
+    return result;
+}
+
+AccessLog::AccessLog(const Options& options):
+    _options(options),
+    _slots(roundUpToPowerOfTwo(options.capacity)),
+    _mask(_slots.size() - 1),
+    _enqueuePos(0),
+    _dequeuePos(0),
+    _sampleCounter(0),
+    _dropped(0),
+    _fd(-1),
+    _fileSize(0),
+    _openFailed(false),
+    _running(true),
+    _thread(nullptr) {
+
+    for (size_t i = 0; i < _slots.size(); i++)
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+
+    if (! open())
+        throw std::runtime_error("access_log: cannot open '" + _options.path + "': " + strerror(errno));
+
+    _thread = new std::thread([this]() { run(); });
+}
+
+AccessLog::~AccessLog() {
+    _running = false;
+    _thread->join();
+    delete _thread;
+
+    if (_fd >= 0)
+        close(_fd);
+}
+
+bool AccessLog::open() {
+    _fd = ::open(_options.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (_fd < 0)
+        return false;
+
+    const off_t size = lseek(_fd, 0, SEEK_END);
+    _fileSize = size > 0 ? size : 0;
+
+    return true;
+}
+
+bool AccessLog::sample() {
+    if (_options.sampleRate <= 1)
+        return true;
+
+    return _sampleCounter.fetch_add(1, std::memory_order_relaxed) % _options.sampleRate == 0;
+}
+
+bool AccessLog::push(const Record& record) {
+    size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+
+    while (true) {
+        Slot& slot = _slots[pos & _mask];
+        const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        const intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+        if (diff == 0) {
+            // the slot is free, try to claim it
+            if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.record = record;
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // the ring is full
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = _enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool AccessLog::pop(Record& record) {
+    Slot& slot = _slots[_dequeuePos & _mask];
+    const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+
+    if ((intptr_t) sequence - (intptr_t) (_dequeuePos + 1) < 0)
+        return false;
+
+    record = slot.record;
+    slot.sequence.store(_dequeuePos + _mask + 1, std::memory_order_release);
+    _dequeuePos++;
+
+    return true;
+}
+
+void AccessLog::setPeer(Record& record, const sockaddr_storage& address) {
+    record.peerFamily = address.ss_family;
+
+    if (address.ss_family == AF_INET) {
+        const sockaddr_in* in = (const sockaddr_in*) &address;
+        record.peerPort = ntohs(in->sin_port);
+        memcpy(record.peerAddress, &in->sin_addr, sizeof(in->sin_addr));
+    } else if (address.ss_family == AF_INET6) {
+        const sockaddr_in6* in6 = (const sockaddr_in6*) &address;
+        record.peerPort = ntohs(in6->sin6_port);
+        memcpy(record.peerAddress, &in6->sin6_addr, sizeof(in6->sin6_addr));
+    }
+}
+
+void AccessLog::setPath(Record& record, const std::string& path) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : path) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+
+    record.pathHash = hash;
+    record.pathLength = path.size();
+
+    const size_t n = path.size() < PATH_LENGTH ? path.size() : PATH_LENGTH;
+    memcpy(record.path, path.data(), n);
+}
+
+void AccessLog::format(const Record& record, std::string& buffer) {
+    char line[256];
+
+    const time_t seconds = record.timestamp / 1000000000;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+
+    char address[INET6_ADDRSTRLEN + 16] = "unix";
+
+    if (record.peerFamily == AF_INET || record.peerFamily == AF_INET6) {
+        char ip[INET6_ADDRSTRLEN] = {0};
+        inet_ntop(record.peerFamily, record.peerAddress, ip, sizeof(ip));
+        snprintf(address, sizeof(address), record.peerFamily == AF_INET6 ? "[%s]:%u" : "%s:%u", ip, record.peerPort);
+    }
+
+    const size_t pathLength = record.pathLength < PATH_LENGTH ? record.pathLength : PATH_LENGTH;
+
+    const int n = snprintf(line, sizeof(line),
+        "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ %s %s %.*s%s %u %llu recv=%uus handle=%uus write=%uus path_hash=%016llx\n",
+        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+        (int) (record.timestamp / 1000000 % 1000),
+        address,
+        HTTP_METHOD_toString(record.method).c_str(),
+        (int) pathLength, record.path, record.pathLength > PATH_LENGTH ? "..." : "",
+        record.statusCode, (unsigned long long) record.bytes,
+        record.receiveUs, record.handleUs, record.writeUs,
+        (unsigned long long) record.pathHash);
+
+    if (n > 0)
+        buffer.append(line, (size_t) n < sizeof(line) ? n : sizeof(line) - 1);
+}
+
+bool AccessLog::reopen() {
+    if (open()) {
+        _openFailed = false;
+        return true;
+    }
+
+    // report the failure once instead of for every flush while it persists
+    if (! _openFailed)
+        fprintf(stderr, "access_log: cannot open '%s': %s, dropping records until it can be opened\n", _options.path.c_str(), strerror(errno));
+
+    _openFailed = true;
+    return false;
+}
+
+void AccessLog::flush(std::string& buffer, const size_t records) {
+    // the file could not be opened again after the last rotation
+    if (_fd < 0 && ! reopen()) {
+        _dropped.fetch_add(records, std::memory_order_relaxed);
+        buffer.clear();
+        return;
+    }
+
+    size_t written = 0;
+
+    while (written < buffer.size()) {
+        const ssize_t n = write(_fd, buffer.data() + written, buffer.size() - written);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("access_log: write");
+            break;
+        }
+
+        written += n;
+    }
+
+    _fileSize += written;
+    buffer.clear();
+
+    if (_options.rotateBytes > 0 && _fileSize >= _options.rotateBytes) {
+        close(_fd);
+
+        _fd = -1;
+
+        if (rename(_options.path.c_str(), (_options.path + ".1").c_str()) < 0)
+            perror("access_log: rename");
+
+        reopen();
+    }
+}
+
+void AccessLog::run() {
+    const size_t flushThreshold = 256 * 1024;
+
+    std::string buffer;
+    buffer.reserve(flushThreshold + 256);
+
+    Record record;
+    size_t records = 0;
+
+    while (true) {
+        // read the flag before draining so no record pushed before stopping is lost
+        const bool running = _running;
+
+        while (pop(record)) {
+            format(record, buffer);
+            records++;
+
+            if (buffer.size() >= flushThreshold) {
+                flush(buffer, records);
+                records = 0;
+            }
+        }
+
+        if (! buffer.empty()) {
+            flush(buffer, records);
+            records = 0;
+        }
+
+        if (! running)
+            break;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(_options.flushIntervalMs));
+    }
+}
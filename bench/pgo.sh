@@ -0,0 +1,32 @@
+#!/bin/sh
+# Builds the plain release and the LTO + PGO configuration and compares their throughput with the
+# same training driver and workload.
+#
+#   bench/pgo.sh [build directory prefix] [seconds per measurement]
+
+set -e
+
+SOURCE_DIR="$(cd "$(dirname "$0")/.." && pwd)"
+PREFIX="${1:-$SOURCE_DIR/_pgo}"
+SECONDS_PER_RUN="${2:-5}"
+JOBS="$(nproc 2>/dev/null || echo 4)"
+
+# plain release build
+cmake -S "$SOURCE_DIR" -B "$PREFIX-release" -DCMAKE_BUILD_TYPE=Release
+cmake --build "$PREFIX-release" -j "$JOBS"
+
+# stage 1: instrumented build, run the training workload
+rm -rf "$PREFIX-pgo/pgo-profiles"
+cmake -S "$SOURCE_DIR" -B "$PREFIX-pgo" -DCMAKE_BUILD_TYPE=Release -DWEBSERVER_LTO=ON -DWEBSERVER_PGO=GENERATE
+cmake --build "$PREFIX-pgo" -j "$JOBS"
+cmake --build "$PREFIX-pgo" --target pgo-train
+
+# stage 2: rebuild in the same directory with the recorded profiles
+cmake -S "$SOURCE_DIR" -B "$PREFIX-pgo" -DWEBSERVER_PGO=USE
+cmake --build "$PREFIX-pgo" -j "$JOBS" --clean-first
+
+echo
+echo "release:"
+"$PREFIX-release/webserver_train" --seconds="$SECONDS_PER_RUN" --port=18600
+echo "lto+pgo:"
+"$PREFIX-pgo/webserver_train" --seconds="$SECONDS_PER_RUN" --port=18601
@@ -0,0 +1,298 @@
+/**
+ * Training and benchmark driver
+ *
+ * Starts an in-process server with a representative route tree and replays a fixed request mix
+ * (routing depth, header sizes, JSON bodies, 404s) against it over loopback.
+ *
+ *   webserver_train --train                  fixed workload used to record PGO / BOLT profiles
+ *   webserver_train --seconds=5 --clients=4  measure throughput and latency
+ *   webserver_train --sweep                  measure the effect of each socket profile knob
+ *
+ * Socket profile knobs: --backlog= --nodelay= --defer-accept= --fastopen= --busy-poll= --sndbuf= --rcvbuf=
+*/
+
+#include "h/server.h"
+#include "h/json_writer.h"
+#include <arpa/inet.h>
+#include <signal.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+/// @brief Server with a route tree similar to a small REST API
+class TrainingServer : public HTTPServer {
+private:
+    static http::Response ok(const std::string& body, const CONTENT_TYPE type = CONTENT_TYPE::TEXT) {
+        http::Response res;
+
+        res.header.StatusCode = 200;
+        res.header.StatusMessage = "OK";
+        res.header.ContentType = type;
+        res.header.Version = "HTTP/1.1";
+        res.header.Connection = "close";
+        res.body.data = body;
+
+        return res;
+    }
+
+public:
+    TrainingServer(const tcp::SocketProfile& profile) {
+        setSocketProfile(profile);
+
+        GET("/", [](const http::Request&) { return ok("ok"); });
+
+        GET("/api/v1/health", [](const http::Request&) { return ok("{\"status\":\"up\"}", CONTENT_TYPE::JSON); });
+
+        GET("/api/v1/users/*", [](const http::Request& req) { return ok("user " + req.header.Path); });
+
+        GET("/api/v1/users/*/posts/*", [](const http::Request& req) { return ok("post " + req.header.Path); });
+
+        GET("/api/v1/items", [](const http::Request&) {
+            http::Response res = ok("");
+            http::JsonWriter json(res, 16 * 1024);
+
+            json.beginObject().key("items").beginArray();
+            for (int i = 0; i < 100; i++) {
+                json.beginObject()
+                    .key("id").value(i)
+                    .key("name").value("item \"" + std::to_string(i) + "\"")
+                    .key("price").value(i * 1.25)
+                    .key("available").value(i % 3 != 0)
+                    .endObject();
+            }
+            json.endArray().endObject();
+
+            return res;
+        });
+
+        POST("/api/v1/items", [](const http::Request& req) { return ok("created " + std::to_string(req.body.data.size())); });
+
+        GET("/api/v1/cached", [](const http::Request&) { return std::string("v42"); }, [](const http::Request&) { return ok("cached resource"); });
+    }
+
+    std::thread* run(const int port, std::atomic_bool* running) {
+        return start(port, running);
+    }
+};
+
+/// @brief The request mix, each entry is sent with the given weight
+static std::vector<std::string> requestMix() {
+    const std::string cookie = "Cookie: session=" + std::string(900, 'c') + "\r\n";
+    const std::string json = "{\"name\":\"item\",\"tags\":[\"a\",\"b\",\"c\"],\"price\":12.5,\"nested\":{\"x\":1,\"y\":[1,2,3]}}";
+
+    const std::vector<std::pair<std::string, int>> weighted = {
+        { "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n", 2 },
+        { "GET /api/v1/health HTTP/1.1\r\nHost: localhost\r\nUser-Agent: train\r\nAccept: */*\r\n\r\n", 3 },
+        { "GET /api/v1/users/42 HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\n" + cookie + "\r\n", 3 },
+        { "GET /api/v1/users/42/posts/7 HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\n\r\n", 3 },
+        { "GET /api/v1/items HTTP/1.1\r\nHost: localhost\r\nAccept: application/json\r\n\r\n", 2 },
+        { "POST /api/v1/items HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(json.size()) + "\r\n\r\n" + json, 2 },
+        { "GET /api/v1/cached HTTP/1.1\r\nHost: localhost\r\nIf-None-Match: \"v42\"\r\n\r\n", 1 },
+        { "GET /api/v1/cached HTTP/1.1\r\nHost: localhost\r\n\r\n", 1 },
+        { "GET /does/not/exist HTTP/1.1\r\nHost: localhost\r\n" + cookie + "\r\n", 2 },
+    };
+
+    std::vector<std::string> mix;
+    for (const auto& entry : weighted)
+        for (int i = 0; i < entry.second; i++)
+            mix.push_back(entry.first);
+
+    std::shuffle(mix.begin(), mix.end(), std::mt19937(42));
+    return mix;
+}
+
+/// @brief Sends one request on a new connection and reads the response until the server closes it
+/// @return true if a complete HTTP response was received
+static bool roundTrip(const int port, const std::string& request) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (sockaddr*) &address, sizeof(address)) < 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < request.size()) {
+        const ssize_t n = write(fd, request.data() + written, request.size() - written);
+        if (n <= 0)
+            break;
+        written += n;
+    }
+
+    char buffer[16 * 1024];
+    std::string response;
+    ssize_t n;
+
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        response.append(buffer, n);
+
+    close(fd);
+
+    return response.compare(0, 9, "HTTP/1.1 ") == 0;
+}
+
+struct Result {
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    double seconds = 0;
+    std::vector<uint32_t> latenciesUs;
+};
+
+/// @brief Runs the request mix with the given number of clients, either for a duration or a fixed number of requests
+static Result runWorkload(const tcp::SocketProfile& profile, const int port, const int clients, const double seconds, const uint64_t totalRequests) {
+    TrainingServer server(profile);
+    std::atomic_bool running(true);
+    std::thread* listener = server.run(port, &running);
+
+    // wait until the listener accepts connections
+    for (int i = 0; i < 100 && ! roundTrip(port, "GET / HTTP/1.1\r\n\r\n"); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    const std::vector<std::string> mix = requestMix();
+    std::vector<Result> results(clients);
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> issued(0);
+
+    const auto begin = std::chrono::steady_clock::now();
+    const auto deadline = begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+
+    for (int c = 0; c < clients; c++) {
+        threads.emplace_back([&, c]() {
+            Result& result = results[c];
+            size_t next = c * 7;
+
+            while (true) {
+                if (totalRequests > 0 ? issued.fetch_add(1) >= totalRequests : std::chrono::steady_clock::now() >= deadline)
+                    break;
+
+                const auto start = std::chrono::steady_clock::now();
+                const bool ok = roundTrip(port, mix[next++ % mix.size()]);
+                const auto end = std::chrono::steady_clock::now();
+
+                result.requests++;
+                if (! ok)
+                    result.errors++;
+                result.latenciesUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+            }
+        });
+    }
+
+    for (std::thread& t : threads)
+        t.join();
+
+    Result total;
+    total.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    for (const Result& result : results) {
+        total.requests += result.requests;
+        total.errors += result.errors;
+        total.latenciesUs.insert(total.latenciesUs.end(), result.latenciesUs.begin(), result.latenciesUs.end());
+    }
+
+    running = false;
+    listener->join();
+    delete listener;
+
+    return total;
+}
+
+static void report(const std::string& name, Result& result) {
+    std::sort(result.latenciesUs.begin(), result.latenciesUs.end());
+
+    const auto percentile = [&result](const double p) -> uint32_t {
+        if (result.latenciesUs.empty())
+            return 0;
+        return result.latenciesUs[std::min(result.latenciesUs.size() - 1, (size_t) (p * result.latenciesUs.size()))];
+    };
+
+    std::printf("%-20s requests=%-8llu errors=%-6llu rps=%-10.0f p50=%uus p99=%uus\n",
+        name.c_str(), (unsigned long long) result.requests, (unsigned long long) result.errors,
+        result.requests / result.seconds, percentile(0.5), percentile(0.99));
+}
+
+int main(int argc, char** argv) {
+    tcp::SocketProfile profile;
+    int port = 18555;
+    int clients = 4;
+    double seconds = 5;
+    uint64_t requests = 0;
+    bool sweep = false;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const size_t equals = arg.find('=');
+        const std::string key = arg.substr(0, equals);
+        const int value = equals == std::string::npos ? 0 : std::atoi(arg.c_str() + equals + 1);
+
+        if (key == "--train")
+            requests = 20000;
+        else if (key == "--sweep")
+            sweep = true;
+        else if (key == "--port")
+            port = value;
+        else if (key == "--clients")
+            clients = value;
+        else if (key == "--seconds")
+            seconds = std::atof(arg.c_str() + equals + 1);
+        else if (key == "--requests")
+            requests = value;
+        else if (key == "--backlog")
+            profile.backlog = value;
+        else if (key == "--nodelay")
+            profile.noDelay = value != 0;
+        else if (key == "--defer-accept")
+            profile.deferAcceptSeconds = value;
+        else if (key == "--fastopen")
+            profile.fastOpenQueue = value;
+        else if (key == "--busy-poll")
+            profile.busyPollMicroseconds = value;
+        else if (key == "--sndbuf")
+            profile.sendBufferSize = value;
+        else if (key == "--rcvbuf")
+            profile.receiveBufferSize = value;
+        else {
+            std::cerr << "unknown option '" << arg << "'" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // a client closing its connection early must not kill the driver
+    signal(SIGPIPE, SIG_IGN);
+
+    if (! sweep) {
+        Result result = runWorkload(profile, port, clients, seconds, requests);
+        report(requests > 0 ? "train" : "run", result);
+        return result.errors * 100 > result.requests ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // each knob is changed on its own against the baseline profile
+    std::vector<std::pair<std::string, tcp::SocketProfile>> configurations;
+    configurations.push_back({ "baseline", profile });
+
+    tcp::SocketProfile p;
+    p = profile; p.noDelay = ! profile.noDelay;     configurations.push_back({ profile.noDelay ? "nodelay=0" : "nodelay=1", p });
+    p = profile; p.backlog = 16;                    configurations.push_back({ "backlog=16", p });
+    p = profile; p.deferAcceptSeconds = 1;          configurations.push_back({ "defer-accept=1", p });
+    p = profile; p.fastOpenQueue = 256;             configurations.push_back({ "fastopen=256", p });
+    p = profile; p.busyPollMicroseconds = 50;       configurations.push_back({ "busy-poll=50", p });
+    p = profile; p.sendBufferSize = 256 * 1024;     configurations.push_back({ "sndbuf=256k", p });
+    p = profile; p.receiveBufferSize = 256 * 1024;  configurations.push_back({ "rcvbuf=256k", p });
+
+    for (size_t i = 0; i < configurations.size(); i++) {
+        Result result = runWorkload(configurations[i].second, port + i, clients, seconds, requests);
+        report(configurations[i].first, result);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -65,13 +65,67 @@ Endpoint* Endpoint::operator[](const std::string& route) const {
     return wildcard;
 }
 
-void Endpoint::addCallback(const HTTP_METHOD method, const std::function<http::Response(const http::Request&)>& callback) {
+void Endpoint::addCallback(const HTTP_METHOD method, const std::function<http::Response(const http::Request&, WorkerContext&)>& callback) {
     if (hasCallbackFor(method))
         throw std::runtime_error("Callback for '" + HTTP_METHOD_toString(method) + " " + _parent + "/" + _route + "' already exists");
 
     _callbacks[method] = callback;
 }
 
+bool Endpoint::hasValidatorFor(const HTTP_METHOD method) const {
+    return _validators.find(method) != _validators.end();
+}
+
+void Endpoint::addValidator(const HTTP_METHOD method, const std::function<std::string(const http::Request&)>& validator) {
+    if (hasValidatorFor(method))
+        throw std::runtime_error("Validator for '" + HTTP_METHOD_toString(method) + " " + _parent + "/" + _route + "' already exists");
+
+    _validators[method] = validator;
+}
+
+const std::function<std::string(const http::Request&)>& Endpoint::getValidator(const HTTP_METHOD method) const {
+    if (!hasValidatorFor(method))
+        throw std::runtime_error("No validator for '" + HTTP_METHOD_toString(method) + " " + _parent + "/" + _route + "'");
+
+    return _validators.find(method)->second;
+}
+
+bool Endpoint::hasUploadFor(const HTTP_METHOD method) const {
+    return _uploads.find(method) != _uploads.end();
+}
+
+void Endpoint::addUpload(const HTTP_METHOD method, const std::function<http::MultipartParser::Callbacks(const http::Request&)>& upload) {
+    if (hasUploadFor(method))
+        throw std::runtime_error("Upload for '" + HTTP_METHOD_toString(method) + " " + _parent + "/" + _route + "' already exists");
+
+    _uploads[method] = upload;
+}
+
+const std::function<http::MultipartParser::Callbacks(const http::Request&)>& Endpoint::getUpload(const HTTP_METHOD method) const {
+    if (!hasUploadFor(method))
+        throw std::runtime_error("No upload for '" + HTTP_METHOD_toString(method) + " " + _parent + "/" + _route + "'");
+
+    return _uploads.find(method)->second;
+}
+
+bool Endpoint::isCoalesced(const HTTP_METHOD method) const {
+    return _coalescing.find(method) != _coalescing.end();
+}
+
+void Endpoint::setCoalescing(const HTTP_METHOD method, const std::vector<std::string>& headers) {
+    if (!hasCallbackFor(method))
+        throw std::runtime_error("No callback for '" + HTTP_METHOD_toString(method) + " " + _parent + "/" + _route + "'");
+
+    _coalescing[method] = headers;
+}
+
+const std::vector<std::string>& Endpoint::getCoalescingHeaders(const HTTP_METHOD method) const {
+    if (!isCoalesced(method))
+        throw std::runtime_error("'" + HTTP_METHOD_toString(method) + " " + _parent + "/" + _route + "' is not coalesced");
+
+    return _coalescing.find(method)->second;
+}
+
 void Endpoint::addChild(Endpoint* child) {
     if (hasChildRoute(child->_route))
         throw std::runtime_error("Child route '" + child->_route + "' already exists");
@@ -79,7 +133,7 @@ void Endpoint::addChild(Endpoint* child) {
     _children.push_back(child);
 }
 
-const std::function<http::Response(const http::Request&)>& Endpoint::getCallback(const HTTP_METHOD method) const {
+const std::function<http::Response(const http::Request&, WorkerContext&)>& Endpoint::getCallback(const HTTP_METHOD method) const {
     if (!hasCallbackFor(method))
         throw std::runtime_error("No callback for '" + HTTP_METHOD_toString(method) + " " + _parent + "/" + _route + "'");
 
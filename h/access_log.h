@@ -0,0 +1,142 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "http.h"
+
+
+/// @brief Asynchronous access log
+/// @details Request threads push fixed-size binary records into a bounded lock-free ring.
+/// A background thread formats the records in batches and writes them with large buffered writes.
+/// Pushing never blocks: if the ring is full the record is dropped and counted instead.
+class AccessLog {
+public:
+
+    struct Options {
+        /// @brief The file the log is written to
+        std::string path = "access.log";
+
+        /// @brief The file is rotated to <path>.1 once it grows beyond this size (0 disables rotation).
+        /// Only one process may write to a rotated file.
+        size_t rotateBytes = 64 * 1024 * 1024;
+
+        /// @brief Only every n-th request is logged
+        unsigned int sampleRate = 1;
+
+        /// @brief Number of records the ring can hold, rounded up to a power of two
+        size_t capacity = 1 << 14;
+
+        /// @brief How long the background thread sleeps when the ring is empty
+        unsigned int flushIntervalMs = 100;
+    };
+
+    /// @brief Length of the path prefix stored in a record
+    static constexpr size_t PATH_LENGTH = 64;
+
+    struct Record {
+        /// @brief Wall clock time the request was received, in nanoseconds since the epoch
+        int64_t timestamp = 0;
+
+        /// @brief Peer address family (AF_INET, AF_INET6 or AF_UNIX), address and port
+        uint16_t peerFamily = 0;
+        uint16_t peerPort = 0;
+        uint8_t peerAddress[16] = {0};
+
+        HTTP_METHOD method = HTTP_METHOD::UNSUPPORTED;
+        unsigned int statusCode = 0;
+        uint64_t bytes = 0;
+
+        /// @brief FNV-1a hash of the full path
+        uint64_t pathHash = 0;
+        /// @brief Length of the full path, the record only keeps the first PATH_LENGTH bytes
+        uint32_t pathLength = 0;
+        char path[PATH_LENGTH] = {0};
+
+        /// @brief Phase latencies in microseconds, a receive phase spans the whole body of a streamed upload
+        uint32_t receiveUs = 0;
+        uint32_t handleUs = 0;
+        uint32_t writeUs = 0;
+    };
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Record record;
+    };
+
+    const Options _options;
+
+    /// @brief The ring buffer
+    std::vector<Slot> _slots;
+    size_t _mask;
+
+    /// @brief Position of the next record to write (producers) and to read (background thread)
+    std::atomic<size_t> _enqueuePos;
+    size_t _dequeuePos;
+
+    std::atomic<uint64_t> _sampleCounter;
+    std::atomic<uint64_t> _dropped;
+
+    /// @brief The log file, -1 if it could not be opened again after a rotation
+    int _fd;
+    size_t _fileSize;
+
+    /// @brief Set while opening the log file fails, so the failure is only reported once
+    bool _openFailed;
+
+    std::atomic_bool _running;
+    std::thread* _thread;
+
+    /// @brief Pops the next record from the ring
+    /// @param record the record to fill
+    /// @return false if the ring is empty
+    bool pop(Record& record);
+
+    /// @brief Appends the formatted record to the buffer
+    static void format(const Record& record, std::string& buffer);
+
+    /// @brief Writes the buffer to the log file and rotates it if necessary
+    /// @param records the number of records in the buffer, counted as dropped if the file cannot be opened
+    void flush(std::string& buffer, const size_t records);
+
+    /// @brief Opens the log file
+    /// @return false if the file cannot be opened, errno is set
+    bool open();
+
+    /// @brief Opens the log file from the background thread, failures are reported once and never thrown
+    bool reopen();
+
+    /// @brief Main loop of the background thread
+    void run();
+
+public:
+    AccessLog(const Options& options);
+
+    /// @brief Stops the background thread after writing all pending records
+    ~AccessLog();
+
+    /// @brief Checks if the current request should be logged according to the sample rate
+    bool sample();
+
+    /// @brief Pushes a record into the ring, never blocks
+    /// @param record the record to log
+    /// @return false if the ring was full and the record was dropped
+    bool push(const Record& record);
+
+    /// @brief The options the access log was created with
+    const Options& options() const { return _options; }
+
+    /// @brief Number of records dropped because the ring was full or the log file could not be opened
+    uint64_t dropped() const { return _dropped; }
+
+    /// @brief Fills the peer fields of a record
+    static void setPeer(Record& record, const sockaddr_storage& address);
+
+    /// @brief Fills the path fields of a record
+    static void setPath(Record& record, const std::string& path);
+};
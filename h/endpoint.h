@@ -5,6 +5,8 @@
 #include <functional>
 
 #include "http.h"
+#include "worker_context.h"
+#include "multipart.h"
 
 class Endpoint {
 private:
@@ -12,7 +14,16 @@ private:
     const std::string _route;
 
     /// @brief The callback functions for the different routes
-    std::unordered_map<HTTP_METHOD, std::function<http::Response(const http::Request&)>> _callbacks;
+    std::unordered_map<HTTP_METHOD, std::function<http::Response(const http::Request&, WorkerContext&)>> _callbacks;
+
+    /// @brief The validator functions (returning an ETag) for the different routes
+    std::unordered_map<HTTP_METHOD, std::function<std::string(const http::Request&)>> _validators;
+
+    /// @brief The functions creating the callbacks for streamed multipart uploads
+    std::unordered_map<HTTP_METHOD, std::function<http::MultipartParser::Callbacks(const http::Request&)>> _uploads;
+
+    /// @brief The request headers forming the coalescing key for routes in single-flight mode
+    std::unordered_map<HTTP_METHOD, std::vector<std::string>> _coalescing;
 
     /// @brief The children of this endpoint
     std::vector<Endpoint*> _children;
@@ -55,12 +66,57 @@ public:
     /// @brief Add a callback function for the given HTTP method
     /// @param method The HTTP method
     /// @param callback The callback function
-    void addCallback(const HTTP_METHOD method, const std::function<http::Response(const http::Request&)>& callback);
+    void addCallback(const HTTP_METHOD method, const std::function<http::Response(const http::Request&, WorkerContext&)>& callback);
 
     /// @brief Get the callback function for the given HTTP method
     /// @param method The HTTP method
     /// @return The callback function for the given HTTP method
-    const std::function<http::Response(const http::Request&)>& getCallback(const HTTP_METHOD method) const;
+    const std::function<http::Response(const http::Request&, WorkerContext&)>& getCallback(const HTTP_METHOD method) const;
+
+    /// @brief Checks if this endpoint has a validator function for the given HTTP method
+    /// @param method The HTTP method to check
+    /// @return True if this endpoint has a validator function for the given HTTP method
+    bool hasValidatorFor(const HTTP_METHOD method) const;
+
+    /// @brief Add a validator function for the given HTTP method
+    /// @param method The HTTP method
+    /// @param validator The validator function returning the ETag of the requested resource
+    void addValidator(const HTTP_METHOD method, const std::function<std::string(const http::Request&)>& validator);
+
+    /// @brief Get the validator function for the given HTTP method
+    /// @param method The HTTP method
+    /// @return The validator function for the given HTTP method
+    const std::function<std::string(const http::Request&)>& getValidator(const HTTP_METHOD method) const;
+
+    /// @brief Checks if this endpoint streams multipart uploads for the given HTTP method
+    /// @param method The HTTP method to check
+    /// @return True if this endpoint has an upload function for the given HTTP method
+    bool hasUploadFor(const HTTP_METHOD method) const;
+
+    /// @brief Add an upload function for the given HTTP method
+    /// @param method The HTTP method
+    /// @param upload The function creating the callbacks receiving the parts of an upload
+    void addUpload(const HTTP_METHOD method, const std::function<http::MultipartParser::Callbacks(const http::Request&)>& upload);
+
+    /// @brief Get the upload function for the given HTTP method
+    /// @param method The HTTP method
+    /// @return The upload function for the given HTTP method
+    const std::function<http::MultipartParser::Callbacks(const http::Request&)>& getUpload(const HTTP_METHOD method) const;
+
+    /// @brief Checks if concurrent requests for the given HTTP method are coalesced
+    /// @param method The HTTP method to check
+    /// @return True if single-flight mode is enabled for the given HTTP method
+    bool isCoalesced(const HTTP_METHOD method) const;
+
+    /// @brief Enable single-flight mode for the given HTTP method
+    /// @param method The HTTP method
+    /// @param headers The request headers (lowercase) that are part of the coalescing key besides the path
+    void setCoalescing(const HTTP_METHOD method, const std::vector<std::string>& headers);
+
+    /// @brief Get the request headers that are part of the coalescing key
+    /// @param method The HTTP method
+    /// @return The request headers that are part of the coalescing key
+    const std::vector<std::string>& getCoalescingHeaders(const HTTP_METHOD method) const;
 
     /// @brief Add a child endpoint
     /// @param child The child endpoint
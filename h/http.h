@@ -2,6 +2,8 @@
 
 
 #include <string>
+#include <unordered_map>
+#include <stdexcept>
 
 enum class HTTP_METHOD {
     GET,
@@ -15,6 +17,7 @@ enum class CONTENT_TYPE {
     TEXT,
     JSON,
     HTML,
+    MULTIPART_FORM_DATA,
     UNSUPPORTED
 };
 
@@ -46,6 +49,10 @@ namespace http {
             std::string Host = "";
             std::string UserAgent = "";
             std::string Accept = "";
+            std::string IfNoneMatch = "";
+
+            /// @brief All header fields of the request, keys in lowercase
+            std::unordered_map<std::string, std::string> Fields;
         };
     }
 
@@ -55,6 +62,7 @@ namespace http {
             std::string StatusMessage = "";
             CONTENT_TYPE ContentType = CONTENT_TYPE::TEXT;
             std::string AccessControlAllowOrigin = "*";
+            std::string ETag = "";
         };
     }
 
@@ -63,12 +71,43 @@ namespace http {
         Body body;
     };
 
+    /// @brief Rejects a malformed or too large request before it reaches a callback, it is answered with the status code
+    class RequestError : public std::runtime_error {
+    private:
+        const unsigned int _statusCode;
+    public:
+        RequestError(const unsigned int statusCode, const std::string& message): std::runtime_error(message), _statusCode(statusCode) {}
+
+        unsigned int StatusCode() const { return _statusCode; }
+    };
+
+    /// @brief Limits for reading a request, exceeding them is answered with an error status
+    struct RequestLimits {
+        /// @brief Time the whole request may take to arrive, including a streamed upload (408)
+        unsigned int timeoutMs = 30000;
+
+        /// @brief Time allowed between two chunks of a body with a known length
+        unsigned int idleTimeoutMs = 5000;
+
+        /// @brief Maximum size of the request line and the header fields (431)
+        size_t maxHeaderSize = 64 * 1024;
+
+        /// @brief Maximum size of a body buffered in memory, streamed uploads are only limited by the timeout (413)
+        size_t maxBodySize = 8 * 1024 * 1024;
+    };
+
     /**
      * @brief Parses a HTTP message
      * @param msg The message to parse
     */
     Request parseHTTPRequest(const std::string& msg);
 
+    /**
+     * @brief Parses only the request line and the header fields of a HTTP message
+     * @param msg The header of the message, the body is ignored and not validated
+    */
+    Request parseHTTPHeader(const std::string& msg);
+
     struct Response {
         Res::Header header;
         Body body;
@@ -80,4 +119,31 @@ namespace http {
     */
     std::string serializeHTTPResponse(const Response& res);
 
+    /**
+     * @brief Serializes the status line and the header fields of a response
+     * @param res The response object
+     * @return the header including the empty line ending it
+    */
+    std::string serializeHTTPHeader(const Response& res);
+
+    /// @brief A serialized response kept in parts, so the body is sent without copying it into the message
+    struct SerializedResponse {
+        /// @brief The status line and the header fields
+        std::string header = "";
+
+        /// @brief The body, moved out of the response
+        std::string body = "";
+
+        /// @brief Sent after the body
+        std::string trailer = "";
+
+        size_t size() const { return header.size() + body.size() + trailer.size(); }
+    };
+
+    /**
+     * @brief Creates a HTTP response from a Response object without copying its body
+     * @param res The response object, its body is moved into the result
+    */
+    SerializedResponse serializeHTTPResponseParts(Response&& res);
+
 }
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <charconv>
+#include <type_traits>
+
+#include "http.h"
+
+
+namespace http {
+
+    /**
+     * @brief Streaming JSON writer that writes directly into the body of a response
+     * @details No Json::Value tree or intermediate string is built. Commas and colons are inserted
+     * automatically. Calls that would produce invalid JSON throw std::runtime_error: closing a container
+     * of the other kind, a key outside of an object, a value inside an object without a key and a
+     * second value at the top level.
+    */
+    class JsonWriter {
+    private:
+        enum class CONTAINER {
+            OBJECT,
+            ARRAY
+        };
+
+        struct Level {
+            CONTAINER kind;
+
+            /// @brief True once the container contains a value or key
+            bool hasValue;
+        };
+
+        std::string& _out;
+
+        /// @brief The open objects and arrays, innermost last
+        std::vector<Level> _levels;
+
+        /// @brief True if a key was written and its value is expected next
+        bool _afterKey = false;
+
+        /// @brief True once the top-level value was started
+        bool _hasRoot = false;
+
+        /// @brief Checks that a value may be written here and writes the comma in front of it if necessary
+        void separator();
+
+        /// @brief Closes the innermost container, which has to be of the given kind
+        void close(const CONTAINER kind, const char bracket);
+
+        /// @brief Writes an escaped string including the quotes
+        void string(std::string_view value);
+    public:
+
+        /**
+         * @brief Creates a writer for the body of the response and sets its content type to JSON
+         * @param res the response to write to, its body is replaced
+         * @param reserve the number of bytes to reserve in the body
+        */
+        JsonWriter(Response& res, const size_t reserve = 0);
+
+        JsonWriter& beginObject();
+        JsonWriter& endObject();
+        JsonWriter& beginArray();
+        JsonWriter& endArray();
+
+        /**
+         * @brief Writes the key of the next member of the current object
+         * @param name the key
+        */
+        JsonWriter& key(std::string_view name);
+
+        JsonWriter& value(std::string_view value);
+        JsonWriter& value(const char* value);
+        JsonWriter& value(const bool value);
+
+        /// @brief Writes a floating point number in the shortest form that round-trips, NaN and infinity are written as null
+        JsonWriter& value(const double value);
+
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value && ! std::is_same<T, bool>::value, JsonWriter&>::type value(const T value) {
+            separator();
+
+            char buffer[24];
+            const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            _out.append(buffer, result.ptr);
+
+            return *this;
+        }
+
+        JsonWriter& null();
+    };
+
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <unordered_map>
+
+
+namespace http {
+
+    /// @brief Headers of one part of a multipart/form-data body
+    struct MultipartPart {
+        /// @brief All header fields of the part, keys in lowercase
+        std::unordered_map<std::string, std::string> Fields;
+
+        /// @brief The name and filename parameters of the Content-Disposition header
+        std::string Name = "";
+        std::string Filename = "";
+
+        std::string ContentType = "";
+    };
+
+    /**
+     * @brief Incremental multipart/form-data parser
+     * @details The body can be fed in chunks of any size as it arrives. Boundaries are found with a
+     * Boyer-Moore-Horspool search and part data is handed to the callbacks immediately, only the last
+     * few bytes that could be the start of a boundary are held back. Memory is bounded by the chunk
+     * size plus the boundary and the part headers, independent of the size of the upload.
+    */
+    class MultipartParser {
+    public:
+        struct Callbacks {
+            /// @brief Called when the headers of a part were parsed.
+            /// Returns a file descriptor the data of the part is written to (not closed by the parser), or -1 to receive it with onData.
+            std::function<int(const MultipartPart&)> onPart;
+
+            /// @brief Called with the data of the current part as it arrives
+            std::function<void(const char*, size_t)> onData;
+
+            /// @brief Called when the current part is complete
+            std::function<void()> onPartEnd;
+        };
+
+        /// @brief Maximum size of the headers of a part
+        static constexpr size_t MAX_HEADER_SIZE = 8 * 1024;
+
+    private:
+        enum class STATE {
+            PREAMBLE,
+            DELIMITER_END,
+            HEADERS,
+            DATA,
+            DONE
+        };
+
+        /// @brief CRLF followed by "--" and the boundary
+        const std::string _delimiter;
+        const Callbacks _callbacks;
+
+        /// @brief Boyer-Moore-Horspool searcher for the delimiter, refers to _delimiter
+        const std::boyer_moore_horspool_searcher<std::string::const_iterator> _searcher;
+
+        STATE _state = STATE::PREAMBLE;
+
+        /// @brief Bytes received but not processed yet
+        std::string _buffer;
+
+        /// @brief The file descriptor the current part is spooled to, -1 if none
+        int _spoolFd = -1;
+
+        /// @brief Searches the delimiter in the buffer, starting at the given position
+        size_t findDelimiter(const size_t from) const;
+
+        /// @brief Hands data of the current part to the callbacks or the spool file
+        void emit(const char* data, const size_t n);
+
+        /// @brief Parses the headers of a part
+        static MultipartPart parsePart(const std::string& headers);
+    public:
+
+        /**
+         * @brief Creates a parser for a body with the given boundary
+         * @details throws RequestError with status 400 if the boundary is invalid
+         * @param boundary the boundary parameter of the Content-Type header
+         * @param callbacks the callbacks receiving the parts
+        */
+        MultipartParser(const std::string& boundary, const Callbacks& callbacks);
+
+        MultipartParser(const MultipartParser&) = delete;
+        MultipartParser& operator=(const MultipartParser&) = delete;
+
+        /**
+         * @brief Feeds the next chunk of the body
+         * @details throws RequestError with status 400 if the body is malformed and 413 if the headers of a part
+         * exceed MAX_HEADER_SIZE, std::system_error if writing to the file of a part fails. Exceptions of the
+         * callbacks are passed on.
+         * @param data the chunk
+         * @param n the length of the chunk
+        */
+        void feed(const char* data, const size_t n);
+
+        /// @brief Checks if the closing boundary was reached
+        bool done() const { return _state == STATE::DONE; }
+
+        /**
+         * @brief Extracts the boundary parameter from a Content-Type header
+         * @param contentType the value of the Content-Type header
+         * @return the boundary or an empty string if there is none
+        */
+        static std::string boundaryOf(const std::string& contentType);
+    };
+
+}
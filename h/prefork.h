@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "tcp.h"
+
+
+namespace prefork {
+
+    /// @brief Environment variable holding the listening sockets handed over by the previous generation
+    extern const char* LISTEN_FDS_ENV;
+
+    /// @brief Environment variable holding the pid of the previous generation's supervisor
+    extern const char* PARENT_PID_ENV;
+
+    /// @brief Maximum size of a message published to the other workers
+    constexpr size_t MAX_MESSAGE_SIZE = 64 * 1024;
+
+    struct Options {
+        /// @brief Number of worker processes, 0 for one per core
+        unsigned int workers = 0;
+
+        /// @brief Delay before a crashed worker is restarted
+        unsigned int restartDelayMs = 100;
+
+        /// @brief Time workers get to finish their connections before they are killed
+        unsigned int shutdownTimeoutMs = 30000;
+
+        /// @brief The executable started on a binary upgrade, empty for the path this process was started from
+        std::string executable = "";
+    };
+
+    /**
+     * @brief returns the listening sockets handed over by the previous generation
+     * @return the file descriptors, empty if this process was not started by a binary upgrade
+    */
+    std::vector<int> inheritedListeners();
+
+    /**
+     * @brief sends a message to all other workers of this generation, relayed by the supervisor
+     * @details the message is dropped for workers that do not keep up with reading their messages
+     * @param message the message, at most MAX_MESSAGE_SIZE bytes
+     * @return false if this process is not a worker started by supervise
+    */
+    bool publish(const std::string& message);
+
+    /**
+     * @brief runs the supervisor: binds the listeners once, forks the workers sharing them and restarts dead workers
+     * @details Signals handled by the supervisor:
+     * SIGTERM / SIGINT / SIGQUIT: stop the workers gracefully and exit.
+     * SIGUSR2: binary upgrade, the executable is started again from its path and inherits the listening sockets.
+     * Once its workers are running the new generation sends SIGQUIT to the old one, which drains and exits.
+     * @param addresses the addresses to listen on (ignored if the listeners were inherited)
+     * @param profile the socket options of the listeners
+     * @param options the supervisor options
+     * @param worker the function run in each worker process, it must return once running is false
+     * @param onMessage called in a worker with the messages published by the other workers, on a separate thread
+     * @return the exit code of the supervisor, EXIT_FAILURE if the listeners cannot be created
+    */
+    int supervise(const std::vector<tcp::ListenAddress>& addresses, const tcp::SocketProfile& profile, const Options& options, const std::function<void(const std::vector<int>&, std::atomic_bool&)>& worker, const std::function<void(const std::string&)>& onMessage = nullptr);
+
+}
@@ -4,19 +4,26 @@
 class HTTPServer;
 
 #include <vector>
+#include <deque>
 #include <thread>
 #include <netinet/in.h>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
 #include <unordered_map>
 #include <arpa/inet.h>
 #include <iostream>
 #include <variant>
+#include <optional>
 #include <functional>
 #include "tcp_conn_info.h"
 #include "tcp.h"
 #include "http.h"
 #include "endpoint.h"
+#include "single_flight.h"
+#include "access_log.h"
+#include "prefork.h"
+#include "tracing.h"
 
 
 class HTTPServer {
@@ -31,20 +38,66 @@ private:
     /// @brief Mutex for the tcpConnections vector
     std::mutex tcpConnections_mutex;
 
+    /// @brief Number of connections currently handled
+    std::atomic_int activeConnections{0};
+
+    /// @brief Signaled when a connection is done, guarded by connectionFinished_mutex
+    std::condition_variable connectionFinished;
+    std::mutex connectionFinished_mutex;
+
     /// @brief The Endpoints
     Endpoint* root;
 
+    /// @brief Coalesces identical requests to routes in single-flight mode
+    SingleFlight singleFlight;
+
+    /// @brief The socket options of the listeners and accepted connections
+    tcp::SocketProfile socketProfile;
+
+    /// @brief Limits for reading requests
+    http::RequestLimits requestLimits;
+
+    /// @brief The options of the access log, empty if disabled
+    std::optional<AccessLog::Options> accessLogOptions;
+
+    /// @brief The access log of this process, nullptr if disabled or not started yet
+    AccessLog* accessLog = nullptr;
+
+    /// @brief The request tracer, nullptr if disabled
+    tracing::Tracer* tracer = nullptr;
+
     /// @brief Add a callback function for a route
     /// @param route the route to add
     /// @param method the HTTP method used
     /// @param callback the callback function
-    void addRoute(const std::string& route, const HTTP_METHOD method, std::function<http::Response(const http::Request&)> callback);
+    void addRoute(const std::string& route, const HTTP_METHOD method, std::function<http::Response(const http::Request&, WorkerContext&)> callback);
+
+    /// @brief Add a validator function for an existing route
+    /// @param route the route
+    /// @param method the HTTP method used
+    /// @param validator the validator function returning the ETag of the resource
+    void addValidator(const std::string& route, const HTTP_METHOD method, std::function<std::string(const http::Request&)> validator);
+
+    /// @brief Get the endpoint of an existing route
+    /// @param route the route
+    /// @return the endpoint of the route
+    Endpoint* getEndpoint(const std::string& route) const;
+
+    /// @brief Find the endpoint handling the request
+    /// @param req incoming http request
+    /// @return the endpoint with a callback for the requested method or nullptr if there is none
+    const Endpoint* findEndpoint(const http::Request& req) const;
 
     /// @brief Callback function for the tcp listener for incoming connection requests
     /// @param address Requesting address
     /// @param b Bank object
     /// @param socketid socket id of the new connection
-    static void tcpConnectionRequestHandler(const sockaddr_in address, HTTPServer* s, const int socketid);
+    static void tcpConnectionRequestHandler(const sockaddr_storage& address, HTTPServer* s, const int socketid);
+
+    /// @brief Callback function for the tcp listener, waits shortly until another connection can be handled
+    /// @param s the server
+    /// @return true if the number of connections is below maxConnections
+    static bool tcpConnectionCapacityHandler(HTTPServer* s);
 
     /// @brief Handles the started http connection
     /// @param info struct holding the connection information
@@ -52,8 +105,50 @@ private:
 
     /// @brief Processes the http request
     /// @param req incoming http request
+    /// @param context the context of the worker handling the request
     /// @return generated http response
-    http::Response processHTTPRequest(const http::Request& req) const;
+    http::Response processHTTPRequest(const http::Request& req, WorkerContext& context) const;
+
+    /// @brief Processes the http request with an already resolved endpoint
+    /// @param req incoming http request
+    /// @param endpoint the endpoint handling the request or nullptr if there is none
+    /// @param context the context of the worker handling the request
+    /// @return generated http response
+    http::Response processHTTPRequest(const http::Request& req, const Endpoint* endpoint, WorkerContext& context) const;
+
+    /// @brief Processes the http request and serializes the response, coalescing identical requests if enabled
+    /// @param req incoming http request
+    /// @param context the context of the worker handling the request
+    /// @return serialized http response
+    std::shared_ptr<const http::SerializedResponse> handleHTTPRequest(const http::Request& req, WorkerContext& context);
+
+    /// @brief Factories creating the slots of the worker contexts
+    std::vector<std::function<std::shared_ptr<void>()>> workerSlotFactories;
+
+    /// @brief All worker contexts
+    std::vector<WorkerContext*> workerContexts;
+
+    /// @brief Worker contexts not used by a connection, in the order they were released
+    std::deque<WorkerContext*> idleWorkerContexts;
+
+    /// @brief Mutex for the worker context vectors
+    std::mutex workerContexts_mutex;
+
+    /// @brief Handles messages broadcast to the workers
+    std::function<void(WorkerContext&, const std::string&)> workerMessageHandler;
+
+    /// @brief Create the worker contexts, called once the worker starts
+    void createWorkerContexts();
+
+    /// @brief Take an idle worker context for a connection
+    WorkerContext* acquireWorkerContext();
+
+    /// @brief Return a worker context once the connection is done
+    void releaseWorkerContext(WorkerContext* context);
+
+    /// @brief Deliver a message to the worker contexts of this process
+    /// @details Idle contexts handle it immediately, busy ones before their next request
+    void deliverToWorkers(const std::string& message);
 
 protected:
     HTTPServer();
@@ -64,9 +159,40 @@ protected:
     /// @param port the port to listen on
     std::thread* start(const int port, std::atomic_bool* running);
 
+    /// @brief Start the http server on multiple listeners (IPv4, IPv6 and Unix domain sockets)
+    /// @details Throws std::runtime_error if one of the listeners cannot be created
+    /// @param addresses the addresses to listen on
+    std::thread* start(const std::vector<tcp::ListenAddress>& addresses, std::atomic_bool* running);
+
+    /// @brief Run the http server in prefork mode: a supervisor process forks workers sharing the listeners
+    /// @details Blocks until the supervisor is stopped. See prefork::supervise for the handled signals.
+    /// @param addresses the addresses to listen on
+    /// @param options the supervisor options
+    /// @return the exit code of the supervisor, EXIT_FAILURE if the listeners cannot be created
+    int serve(const std::vector<tcp::ListenAddress>& addresses, const prefork::Options& options);
+
     /// @brief Stop the server
     void stop();
 
+    /// @brief Set the socket options used by the listeners, must be called before start or serve
+    /// @param profile the socket options
+    void setSocketProfile(const tcp::SocketProfile& profile);
+
+    /// @brief Set the limits for reading requests, must be called before start or serve
+    /// @param limits the limits
+    void setRequestLimits(const http::RequestLimits& limits);
+
+    /// @brief Record the phases of the requests, sampled and slow requests are kept for export
+    /// @param options the tracing options
+    /// @param adminRoute if not empty a GET route exporting the traces as Chrome trace event JSON (Perfetto)
+    void enableTracing(const tracing::Options& options, const std::string& adminRoute = "");
+
+    /// @brief Log every request to an access log written by a background thread, must be called before start or serve
+    /// @details The log is opened by start, which throws if it cannot be opened. In prefork mode only the
+    /// workers open a log, each writes and rotates its own file <path>.<pid>.
+    /// @param options the access log options
+    void enableAccessLog(const AccessLog::Options& options);
+
 public:
 
     /// @brief Add a callback function for a GET route
@@ -74,19 +200,98 @@ public:
     /// @param callback the callback function
     void GET(const std::string& route, std::function<http::Response(const http::Request&)> callback);
 
+    /// @brief Add a callback function for a GET route with a validator for conditional requests
+    /// @details If the ETag returned by the validator matches the If-None-Match header of the request,
+    /// the server answers with 304 Not Modified without invoking the callback.
+    /// @param route the route to add
+    /// @param validator cheap function returning the ETag (or version) of the requested resource
+    /// @param callback the callback function
+    void GET(const std::string& route, std::function<std::string(const http::Request&)> validator, std::function<http::Response(const http::Request&)> callback);
+
+    /// @brief Add a callback function with access to the worker context for a GET route with a validator for conditional requests
+    /// @param route the route to add
+    /// @param validator cheap function returning the ETag (or version) of the requested resource
+    /// @param callback the callback function
+    void GET(const std::string& route, std::function<std::string(const http::Request&)> validator, std::function<http::Response(const http::Request&, WorkerContext&)> callback);
+
+    /// @brief Enable single-flight mode for an existing GET route
+    /// @details Concurrent requests with the same path and the same values for the given headers
+    /// wait for one invocation of the callback and all receive its serialized response.
+    /// @param route the route
+    /// @param headers additional request headers that are part of the coalescing key
+    void coalesce(const std::string& route, const std::vector<std::string>& headers = {});
+
+    /// @brief Add a callback function with access to the worker context for a GET route
+    /// @param route the route to add
+    /// @param callback the callback function
+    void GET(const std::string& route, std::function<http::Response(const http::Request&, WorkerContext&)> callback);
+
     /// @brief Add a callback function for a POST route
     /// @param route the route to add
     /// @param callback the callback function
     void POST(const std::string& route, std::function<http::Response(const http::Request&)> callback);
 
+    /// @brief Add a callback function for a POST route receiving multipart/form-data uploads as a stream
+    /// @details The parts are handed to the callbacks created by upload as the bytes arrive, the body is never
+    /// buffered in full. The callback is invoked once the upload is complete, the request body is empty.
+    /// Requests with another content type are passed to the callback with their body as usual.
+    /// @param route the route to add
+    /// @param upload function creating the callbacks receiving the parts of an upload
+    /// @param callback the callback function
+    void POST(const std::string& route, std::function<http::MultipartParser::Callbacks(const http::Request&)> upload, std::function<http::Response(const http::Request&)> callback);
+
+    /// @brief Add a callback function with access to the worker context for a POST route receiving multipart/form-data uploads as a stream
+    /// @param route the route to add
+    /// @param upload function creating the callbacks receiving the parts of an upload
+    /// @param callback the callback function
+    void POST(const std::string& route, std::function<http::MultipartParser::Callbacks(const http::Request&)> upload, std::function<http::Response(const http::Request&, WorkerContext&)> callback);
+
+    /// @brief Add a callback function with access to the worker context for a POST route
+    /// @param route the route to add
+    /// @param callback the callback function
+    void POST(const std::string& route, std::function<http::Response(const http::Request&, WorkerContext&)> callback);
+
     /// @brief Add a callback function for a PUT route
     /// @param route the route to add
     /// @param callback the callback function
     void PUT(const std::string& route, std::function<http::Response(const http::Request&)> callback);
 
+    /// @brief Add a callback function with access to the worker context for a PUT route
+    /// @param route the route to add
+    /// @param callback the callback function
+    void PUT(const std::string& route, std::function<http::Response(const http::Request&, WorkerContext&)> callback);
+
     /// @brief Add a callback function for a DELETE route
     /// @param route the route to add
     /// @param callback the callback function
     void DELETE(const std::string& route, std::function<http::Response(const http::Request&)> callback);
 
+    /// @brief Add a callback function with access to the worker context for a DELETE route
+    /// @param route the route to add
+    /// @param callback the callback function
+    void DELETE(const std::string& route, std::function<http::Response(const http::Request&, WorkerContext&)> callback);
+
+    /// @brief Register a slot in the worker contexts, must be called before the server is started
+    /// @details Every worker creates its own object with the factory when it starts,
+    /// handlers access it with context.get(slot) without sharing it with other workers.
+    /// @param factory the function creating the object of a worker
+    /// @return the handle of the slot
+    template <typename T>
+    WorkerSlot<T> addWorkerSlot(std::function<std::shared_ptr<T>()> factory) {
+        workerSlotFactories.push_back([factory]() { return std::static_pointer_cast<void>(factory()); });
+        return WorkerSlot<T>(workerSlotFactories.size() - 1);
+    }
+
+    /// @brief Set the function handling broadcast messages
+    /// @details The handler runs in a busy worker before its next request is processed.
+    /// Idle workers handle the message right away on the broadcasting thread, the handler may broadcast itself.
+    /// @param handler the function handling a message for a worker context
+    void onWorkerMessage(std::function<void(WorkerContext&, const std::string&)> handler);
+
+    /// @brief Send a message to all workers, e.g. to invalidate their caches
+    /// @details In prefork mode the message is also relayed to the other worker processes of the
+    /// same generation, it must not be larger than prefork::MAX_MESSAGE_SIZE.
+    /// @param message the message
+    void broadcast(const std::string& message);
+
 };
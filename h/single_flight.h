@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+
+#include "http.h"
+
+
+/// @brief Collapses concurrent calls with the same key into a single invocation
+class SingleFlight {
+private:
+    /// @brief The result of a call, shared between the caller and all waiters
+    typedef std::shared_future<std::shared_ptr<const http::SerializedResponse>> Result;
+
+    /// @brief The calls currently in flight
+    std::unordered_map<std::string, Result> _inFlight;
+
+    /// @brief Mutex for the _inFlight map
+    std::mutex _mutex;
+public:
+
+    /// @brief Run the function or wait for the result of an identical call already in flight
+    /// @details Waiters block on the shared result without polling and are woken as soon as the
+    /// leading call returns. Exceptions thrown by the function are rethrown in every caller.
+    /// @param key the key identifying identical calls
+    /// @param fn the function producing the result
+    /// @return the result shared by all callers with the same key
+    std::shared_ptr<const http::SerializedResponse> run(const std::string& key, const std::function<http::SerializedResponse()>& fn);
+};
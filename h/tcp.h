@@ -8,22 +8,145 @@
 #include <unistd.h>
 #include <atomic>
 #include <thread>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/stat.h>
+#include <netinet/tcp.h>
 
-#include "server.h"
+class HTTPServer;
 
 
 namespace tcp {
 
-    
+    enum class FAMILY {
+        IPV4,
+        IPV6,
+        UNIX
+    };
+
+    /**
+     * @brief describes an address to listen on
+    */
+    struct ListenAddress {
+        FAMILY family = FAMILY::IPV4;
+
+        /// @brief the port (IPv4 and IPv6)
+        int port = 0;
+
+        /// @brief the address to bind to, empty for any address (IPv4 and IPv6)
+        std::string host = "";
+
+        /// @brief only accept IPv6 connections instead of dual-stack (IPv6)
+        bool v6Only = false;
+
+        /// @brief the path of the socket file (Unix domain sockets)
+        std::string path = "";
+
+        /// @brief the permissions of the socket file (Unix domain sockets)
+        mode_t permissions = 0660;
+    };
+
+    /**
+     * @brief socket options applied to the listeners and accepted connections
+     * @details options set to 0 keep the system default
+    */
+    struct SocketProfile {
+        /// @brief the listen backlog
+        int backlog = SOMAXCONN;
+
+        /// @brief disable Nagle's algorithm on accepted connections (TCP_NODELAY)
+        bool noDelay = true;
+
+        /// @brief only wake the listener once data arrived, in seconds (TCP_DEFER_ACCEPT)
+        int deferAcceptSeconds = 0;
+
+        /// @brief queue length for TCP Fast Open connections (TCP_FASTOPEN)
+        int fastOpenQueue = 0;
+
+        /// @brief busy poll the device queue on reads of accepted connections, in microseconds (SO_BUSY_POLL)
+        int busyPollMicroseconds = 0;
+
+        /// @brief send buffer size of accepted connections in bytes (SO_SNDBUF)
+        int sendBufferSize = 0;
+
+        /// @brief receive buffer size in bytes, set on the listener so accepted connections inherit it (SO_RCVBUF)
+        int receiveBufferSize = 0;
+
+    };
+
+    /**
+     * @brief creates an IPv4 listen address
+     * @param port the port to listen on
+     * @param host the address to bind to, empty for any address
+    */
+    ListenAddress ipv4Address(const int port, const std::string& host = "");
+
     /**
-     * @brief opens a listener for new connections on the given port
+     * @brief creates an IPv6 listen address
      * @param port the port to listen on
-     * @param maxConnections the maximum amount of connections
+     * @param v6Only false to also accept IPv4 connections (dual-stack)
+     * @param host the address to bind to, empty for any address
+    */
+    ListenAddress ipv6Address(const int port, const bool v6Only = false, const std::string& host = "");
+
+    /**
+     * @brief creates a Unix domain socket listen address
+     * @param path the path of the socket file
+     * @param permissions the permissions of the socket file
+    */
+    ListenAddress unixAddress(const std::string& path, const mode_t permissions = 0660);
+
+    /**
+     * @brief creates a listening socket for the given address
+     * @details an existing Unix socket file is only replaced if no server listens on it anymore,
+     * the listener is not created if the path is in use or is not a socket
+     * @param address the address to listen on
+     * @param profile the socket options
+     * @return the file descriptor of the listening socket, -1 if it could not be created (the reason is printed)
+    */
+    int bindListener(const ListenAddress& address, const SocketProfile& profile);
+
+    /**
+     * @brief creates listening sockets for all given addresses
+     * @param addresses the addresses to listen on
+     * @param profile the socket options
+     * @return the file descriptors in the order of the addresses, empty if one of them could not be created
+    */
+    std::vector<int> bindListeners(const std::vector<ListenAddress>& addresses, const SocketProfile& profile);
+
+    /**
+     * @brief closes listening sockets and removes the socket files of Unix domain sockets
+     * @param fds the file descriptors returned by bindListeners
+     * @param addresses the addresses the listeners were created for
+    */
+    void closeListeners(const std::vector<int>& fds, const std::vector<ListenAddress>& addresses);
+
+    /**
+     * @brief accepts new connections on already bound listening sockets until running is false
+     * @details the sockets are neither shut down nor closed, they may be shared with other processes.
+     * All pending connections are accepted in one wakeup as long as capacityHandler reports a free slot,
+     * the remaining ones stay in the listen backlog.
+     * @param listeners the file descriptors of the listening sockets
+     * @param profile the socket options applied to accepted connections
+     * @param messageHandler the function to call when a connection is accepted
+     * @param capacityHandler the function called before each accept, may block shortly and returns false if no connection can be handled
+     * @param obj the object to pass to the messageHandler
+     * @param running the atomic bool to check if the listener should still run
+    */
+    void serveListeners(const std::vector<int>& listeners, const SocketProfile& profile, void (*messageHandler)(const sockaddr_storage&, HTTPServer*, const int), bool (*capacityHandler)(HTTPServer*), HTTPServer* obj, std::atomic_bool& running);
+
+    /**
+     * @brief opens listeners for new connections on the given addresses
+     * @param addresses the addresses to listen on
+     * @param profile the socket options
      * @param messageHandler the function to call when a message is received
+     * @param capacityHandler the function called before each accept, see serveListeners
      * @param obj the object to pass to the messageHandler
      * @param running the atomic bool to check if the listener should still run
+     * @return false if the listeners could not be created
     */
-    void openListener(const int port, const int maxConnections, void (*messageHandler)(const sockaddr_in, HTTPServer*, const int), HTTPServer* obj, std::atomic_bool& running);
+    bool openListener(const std::vector<ListenAddress>& addresses, const SocketProfile& profile, void (*messageHandler)(const sockaddr_storage&, HTTPServer*, const int), bool (*capacityHandler)(HTTPServer*), HTTPServer* obj, std::atomic_bool& running);
 
     /**
      * @brief sends a message to the given address
@@ -34,13 +157,22 @@ namespace tcp {
     */
     std::thread* send(const std::string msg, const int socket);
 
+    /**
+     * @brief sends the parts of a message with as few system calls as possible, without joining them first
+     * @param parts the parts of the message, they must stay valid until the function returns
+     * @param socket the socket to send the message with
+     * @return true if the whole message was sent
+    */
+    bool sendv(const std::vector<std::string_view>& parts, const int socket);
+
     /**
      * @brief receives a message from the given socket
      * @param socket the socket to receive the message from
      * @param buffer the buffer to store the message in
      * @param n the length of the buffer
-     * @return the amount of bytes received
+     * @param timeoutMs how long to wait for data on a non-blocking socket
+     * @return the amount of bytes received, 0 if the connection was closed or the timeout expired
     */
-    int rcv(const int socket, char* buffer, const int n);
+    int rcv(const int socket, char* buffer, const int n, const int timeoutMs = 100);
 
 }
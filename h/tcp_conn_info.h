@@ -1,20 +1,22 @@
 #pragma once
 
-#include <netinet/in.h>
+#include <sys/socket.h>
 #include <atomic>
 #include <thread>
+#include <chrono>
 #include <exception>
 
 
 class TCP_CONN_INFO {
 private:
-    const sockaddr_in address;
+    const sockaddr_storage address;
     std::atomic_bool* running;
     const int socket;
     std::thread* thread;
+    const std::chrono::steady_clock::time_point accepted;
 public:
-    TCP_CONN_INFO(const sockaddr_in address, std::atomic_bool* running, const int socket, std::thread* thread):
-        address(address), running(running), socket(socket), thread(thread) {}
+    TCP_CONN_INFO(const sockaddr_storage& address, std::atomic_bool* running, const int socket, std::thread* thread):
+        address(address), running(running), socket(socket), thread(thread), accepted(std::chrono::steady_clock::now()) {}
 
     ~TCP_CONN_INFO() {
         *running = false;
@@ -24,10 +26,11 @@ public:
         delete thread;
     }
 
-    sockaddr_in Address() const { return address; }
+    const sockaddr_storage& Address() const { return address; }
     bool Running() const { return *running; }
     int Socket() const { return socket; }
     std::thread* Thread() const { return thread; }
+    std::chrono::steady_clock::time_point Accepted() const { return accepted; }
 
     void setThread(std::thread* thread) { if (this->thread == nullptr) this->thread = thread; else throw std::runtime_error("tcp_conn_info: setThread"); }
     void stop() { (*running) = false; }
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+namespace tracing {
+
+    /// @brief The phases of a request
+    enum class PHASE {
+        /// @brief From the accepted connection until its handler thread runs
+        DISPATCH,
+        RECEIVE,
+        PARSE,
+        ROUTE,
+        CALLBACK,
+        SERIALIZE,
+        WRITE,
+        COUNT
+    };
+
+    std::string PHASE_toString(PHASE phase);
+
+    struct Options {
+        /// @brief Every n-th request is kept
+        unsigned int sampleRate = 100;
+
+        /// @brief Number of sampled requests kept, rounded up to a power of two
+        size_t capacity = 4096;
+
+        /// @brief Requests slower than this are always kept, in microseconds (0 disables slow-request capture)
+        uint64_t slowThresholdUs = 0;
+
+        /// @brief Number of slow requests kept, rounded up to a power of two
+        size_t slowCapacity = 256;
+
+        /// @brief Time window exported by the admin endpoint, in seconds
+        unsigned int dumpSeconds = 10;
+    };
+
+    /// @brief Length of the path prefix stored in a trace
+    static constexpr size_t PATH_LENGTH = 64;
+
+    /// @brief Timestamps of the phases of one request
+    struct Trace {
+        /// @brief Thread that handled the request
+        uint32_t tid = 0;
+
+        /// @brief Start and end of each phase in nanoseconds (CLOCK_MONOTONIC), 0 if the phase did not run
+        uint64_t begin[(size_t) PHASE::COUNT] = {0};
+        uint64_t end[(size_t) PHASE::COUNT] = {0};
+
+        char path[PATH_LENGTH] = {0};
+    };
+
+    /// @brief Returns the current time of the monotonic clock in nanoseconds
+    inline uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /// @brief Sets the trace the phases of the calling thread are recorded to, nullptr to stop recording
+    void attach(Trace* trace);
+
+    /// @brief Returns the trace of the calling thread or nullptr if the thread is not traced
+    Trace* current();
+
+    /// @brief Records a phase of the current trace from construction until end() or destruction
+    class Span {
+    private:
+        Trace* _trace;
+        const PHASE _phase;
+    public:
+        Span(const PHASE phase): _trace(current()), _phase(phase) {
+            if (_trace != nullptr)
+                _trace->begin[(size_t) _phase] = now();
+        }
+
+        ~Span() { end(); }
+
+        /// @brief Ends the phase early
+        void end() {
+            if (_trace != nullptr)
+                _trace->end[(size_t) _phase] = now();
+            _trace = nullptr;
+        }
+    };
+
+    /// @brief Keeps sampled and slow traces in lock-free rings and exports them
+    class Tracer {
+    private:
+        struct Slot {
+            /// @brief Odd while the trace is written
+            std::atomic<uint64_t> sequence;
+            Trace trace;
+        };
+
+        const Options _options;
+
+        std::vector<Slot> _sampled;
+        std::vector<Slot> _slow;
+
+        std::atomic<uint64_t> _sampledHead;
+        std::atomic<uint64_t> _slowHead;
+        std::atomic<uint64_t> _counter;
+
+        /// @brief Stores the trace in the next slot of the ring, drops it if the slot is being written
+        static void store(std::vector<Slot>& ring, std::atomic<uint64_t>& head, const Trace& trace);
+
+        /// @brief Appends the trace events of all traces in the ring ending after the given time
+        static void dump(const std::vector<Slot>& ring, const uint64_t since, const char* category, std::string& out, bool& first);
+    public:
+        Tracer(const Options& options);
+
+        /// @brief The options the tracer was created with
+        const Options& options() const { return _options; }
+
+        /// @brief Keeps the trace if it is sampled or slower than the threshold
+        void record(const Trace& trace);
+
+        /// @brief Exports the traces as Chrome trace event JSON, which can be opened in Perfetto
+        /// @param seconds the time window of sampled traces to export, slow traces are always exported
+        /// @return the JSON document
+        std::string dumpChromeTrace(const unsigned int seconds) const;
+    };
+
+    /// @brief Fills the path of a trace
+    void setPath(Trace& trace, const std::string& path);
+}
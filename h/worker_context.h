@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+
+
+/// @brief Handle of a typed slot in the worker contexts, returned when the slot is registered
+template <typename T>
+class WorkerSlot {
+private:
+    size_t _index;
+public:
+    explicit WorkerSlot(const size_t index): _index(index) {}
+
+    /// @brief Get the index of the slot
+    size_t index() const { return _index; }
+};
+
+/// @brief State owned by a single worker, passed to the handlers
+/// @details A context is used by one connection at a time, so the state in its slots needs no locking.
+/// Other workers can only reach it by posting messages, which are delivered before the next handler call
+/// or right away while the context is idle.
+class WorkerContext {
+private:
+    const size_t _id;
+
+    /// @brief The slots created by the factories
+    std::vector<std::shared_ptr<void>> _slots;
+
+    /// @brief Messages posted by other threads that were not delivered yet
+    std::vector<std::string> _inbox;
+
+    /// @brief Mutex for the _inbox vector
+    std::mutex _inboxMutex;
+
+    /// @brief Set when the inbox is not empty, checked without locking
+    std::atomic_bool _hasMessages;
+public:
+
+    /// @brief Construct a new WorkerContext object
+    /// @param id The id of the worker
+    /// @param factories The factories creating the slots
+    WorkerContext(const size_t id, const std::vector<std::function<std::shared_ptr<void>()>>& factories);
+
+    /// @brief Get the id of the worker
+    size_t id() const { return _id; }
+
+    /// @brief Get the object in the given slot
+    /// @param slot The slot returned when it was registered
+    /// @return The object created by the slot's factory for this worker
+    template <typename T>
+    T& get(const WorkerSlot<T>& slot) { return *static_cast<T*>(_slots.at(slot.index()).get()); }
+
+    /// @brief Post a message to this worker, can be called from any thread
+    /// @param message The message
+    void post(const std::string& message);
+
+    /// @brief Deliver all pending messages to the given handler
+    /// @param handler The function to call for each message
+    void deliver(const std::function<void(WorkerContext&, const std::string&)>& handler);
+};
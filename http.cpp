@@ -23,18 +23,14 @@ static void removeCarrierReturn(std::string& str) {
     }
 }
 
-Request http::parseHTTPRequest(const std::string& msg) {
-    std::string message(msg);
-    removeCarrierReturn(message);
-
-    std::stringstream ss(message);
+/// @brief Parses the request line and the header fields, leaves the stream at the start of the body
+static void parseHeader(std::stringstream& ss, Request& req) {
     std::string method, path, version;
 
     std::getline(ss, method, ' ');
     std::getline(ss, path, ' ');
     std::getline(ss, version, '\n');
 
-    Request req;
     req.header.Method = HTTP_METHOD_fromString(method);
     req.header.Path = path;
     req.header.Version = version;
@@ -46,12 +42,16 @@ Request http::parseHTTPRequest(const std::string& msg) {
         const int indexOfKeyEnd = indexOf(line, ':');
 
         if (indexOfKeyEnd == -2)
-            throw std::runtime_error("Invalid HTTP header");
+            throw http::RequestError(400, "Invalid HTTP header");
 
         const std::string key = line.substr(0, indexOfKeyEnd);
         std::string value = line.substr(indexOfKeyEnd+1, line.size()-indexOfKeyEnd);
         trim(value);
 
+        std::string field(key);
+        std::transform(field.begin(), field.end(), field.begin(), [](unsigned char c) { return std::tolower(c); });
+        req.header.Fields[field] = value;
+
         if (key == "Host") {
             req.header.Host = value;
         } else if (key == "Connection") {
@@ -60,12 +60,36 @@ Request http::parseHTTPRequest(const std::string& msg) {
             req.header.UserAgent = value;
         } else if (key == "Accept") {
             req.header.Accept = value;
+        } else if (key == "If-None-Match") {
+            req.header.IfNoneMatch = value;
         } else if (key == "Content-Type") {
             req.header.ContentType = CONTENT_TYPE_fromString(value);
         }
 
         std::getline(ss, line, '\n');
     }
+}
+
+Request http::parseHTTPHeader(const std::string& msg) {
+    std::string message(msg);
+    removeCarrierReturn(message);
+
+    std::stringstream ss(message);
+
+    Request req;
+    parseHeader(ss, req);
+
+    return req;
+}
+
+Request http::parseHTTPRequest(const std::string& msg) {
+    std::string message(msg);
+    removeCarrierReturn(message);
+
+    std::stringstream ss(message);
+
+    Request req;
+    parseHeader(ss, req);
 
     std::string body;
     std::getline(ss, body, '\0');
@@ -84,18 +108,52 @@ Request http::parseHTTPRequest(const std::string& msg) {
     return req;
 }
 
+std::string http::serializeHTTPHeader(const Response& res) {
+    const std::string contentType = CONTENT_TYPE_toString(res.header.ContentType);
+
+    std::string msg;
+    msg.reserve(192 + res.header.Version.size() + res.header.StatusMessage.size() + res.header.Connection.size() + res.header.ETag.size());
+
+    msg.append(res.header.Version).append(" ").append(std::to_string(res.header.StatusCode)).append(" ").append(res.header.StatusMessage).append("\r\n");
+    msg.append("Connection: ").append(res.header.Connection).append("\r\n");
+    msg.append("Content-Type: ").append(contentType).append("\r\n");
+    msg.append("Access-Control-Allow-Origin: *\r\n");
+
+    if (! res.header.ETag.empty())
+        msg.append("ETag: ").append(res.header.ETag).append("\r\n");
+
+    // a 304 response must not contain a body
+    if (res.header.StatusCode != 304)
+        msg.append("Content-Length: ").append(std::to_string(res.body.data.size())).append("\r\n");
+
+    msg.append("\r\n");
+
+    return msg;
+}
+
+SerializedResponse http::serializeHTTPResponseParts(Response&& res) {
+    SerializedResponse serialized;
+    serialized.header = serializeHTTPHeader(res);
+
+    if (res.header.StatusCode != 304) {
+        serialized.body = std::move(res.body.data);
+        serialized.trailer = "\r\n\r\n";
+    }
+
+    return serialized;
+}
+
 std::string http::serializeHTTPResponse(const Response& res) {
-    std::stringstream ss;
-    ss << res.header.Version << " " << res.header.StatusCode << " " << res.header.StatusMessage << "\r\n";
-    ss << "Connection: " << res.header.Connection << "\r\n";
-    ss << "Content-Type: " << CONTENT_TYPE_toString(res.header.ContentType) << "\r\n";
-    ss << "Access-Control-Allow-Origin: *\r\n";
-    ss << "Content-Length: " << res.body.data.size() << "\r\n";
-    ss << "\r\n";
-    ss << res.body.data;
-    ss << "\r\n\r\n";
-
-    return ss.str();
+    std::string msg = serializeHTTPHeader(res);
+
+    if (res.header.StatusCode == 304)
+        return msg;
+
+    msg.reserve(msg.size() + res.body.data.size() + 4);
+    msg.append(res.body.data);
+    msg.append("\r\n\r\n");
+
+    return msg;
 }
 
 std::string HTTP_METHOD_toString(HTTP_METHOD method) {
@@ -134,18 +192,26 @@ std::string CONTENT_TYPE_toString(CONTENT_TYPE type) {
         return "application/json";
     case CONTENT_TYPE::HTML:
         return "text/html";
+    case CONTENT_TYPE::MULTIPART_FORM_DATA:
+        return "multipart/form-data";
     default:
         return "UNSUPPORTED";
     }
 }
 
-CONTENT_TYPE CONTENT_TYPE_fromString(const std::string& type) {
+CONTENT_TYPE CONTENT_TYPE_fromString(const std::string& value) {
+    // ignore parameters like charset or boundary
+    std::string type = value.substr(0, value.find(';'));
+    trim(type);
+
     if (type == "text/plain")
         return CONTENT_TYPE::TEXT;
     else if (type == "application/json")
         return CONTENT_TYPE::JSON;
     else if (type == "text/html")
         return CONTENT_TYPE::HTML;
+    else if (type == "multipart/form-data")
+        return CONTENT_TYPE::MULTIPART_FORM_DATA;
     else
         return CONTENT_TYPE::UNSUPPORTED;
 }
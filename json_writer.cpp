@@ -0,0 +1,208 @@
+#include "h/json_writer.h"
+#include <cmath>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+using namespace http;
+
+JsonWriter::JsonWriter(Response& res, const size_t reserve): _out(res.body.data) {
+    res.header.ContentType = CONTENT_TYPE::JSON;
+    _out.clear();
+    _out.reserve(reserve);
+}
+
+void JsonWriter::separator() {
+    if (_levels.empty()) {
+        if (_hasRoot)
+            throw std::runtime_error("JsonWriter: second top-level value");
+        _hasRoot = true;
+        return;
+    }
+
+    Level& level = _levels.back();
+
+    if (level.kind == CONTAINER::OBJECT) {
+        if (! _afterKey)
+            throw std::runtime_error("JsonWriter: value without a key in an object");
+        _afterKey = false;
+        return;
+    }
+
+    if (level.hasValue)
+        _out += ',';
+    level.hasValue = true;
+}
+
+void JsonWriter::close(const CONTAINER kind, const char bracket) {
+    if (_levels.empty() || _levels.back().kind != kind)
+        throw std::runtime_error(kind == CONTAINER::OBJECT ? "JsonWriter: endObject without an open object" : "JsonWriter: endArray without an open array");
+    if (_afterKey)
+        throw std::runtime_error("JsonWriter: key without a value");
+
+    _levels.pop_back();
+    _out += bracket;
+}
+
+JsonWriter& JsonWriter::beginObject() {
+    separator();
+    _out += '{';
+    _levels.push_back({CONTAINER::OBJECT, false});
+    return *this;
+}
+
+JsonWriter& JsonWriter::endObject() {
+    close(CONTAINER::OBJECT, '}');
+    return *this;
+}
+
+JsonWriter& JsonWriter::beginArray() {
+    separator();
+    _out += '[';
+    _levels.push_back({CONTAINER::ARRAY, false});
+    return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+    close(CONTAINER::ARRAY, ']');
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(std::string_view name) {
+    if (_levels.empty() || _levels.back().kind != CONTAINER::OBJECT)
+        throw std::runtime_error("JsonWriter: key outside of an object");
+    if (_afterKey)
+        throw std::runtime_error("JsonWriter: key without a value");
+
+    Level& level = _levels.back();
+    if (level.hasValue)
+        _out += ',';
+    level.hasValue = true;
+
+    string(name);
+    _out += ':';
+    _afterKey = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(std::string_view value) {
+    separator();
+    string(value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(const char* value) {
+    return this->value(std::string_view(value));
+}
+
+JsonWriter& JsonWriter::value(const bool value) {
+    separator();
+    _out += value ? "true" : "false";
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(const double value) {
+    if (! std::isfinite(value))
+        return null();
+
+    separator();
+
+    char buffer[32];
+    const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    _out.append(buffer, result.ptr);
+
+    return *this;
+}
+
+JsonWriter& JsonWriter::null() {
+    separator();
+    _out += "null";
+    return *this;
+}
+
+/// @brief Checks if the character has to be escaped in a JSON string
+static inline bool needsEscape(const unsigned char c) {
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+void JsonWriter::string(std::string_view value) {
+    static const char hex[] = "0123456789abcdef";
+
+    _out += '"';
+
+    const char* data = value.data();
+    const size_t n = value.size();
+    size_t i = 0;
+
+    while (i < n) {
+        // copy the longest run of characters that need no escaping at once
+        size_t run = i;
+
+#ifdef __SSE2__
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1F);
+
+        while (run + 16 <= n) {
+            const __m128i chunk = _mm_loadu_si128((const __m128i*) (data + run));
+            const __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+                // unsigned chunk <= 0x1F
+                _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+
+            const int mask = _mm_movemask_epi8(special);
+
+            if (mask != 0) {
+                run += __builtin_ctz(mask);
+                break;
+            }
+
+            run += 16;
+        }
+#endif
+
+        while (run < n && ! needsEscape(data[run]))
+            run++;
+
+        _out.append(data + i, run - i);
+        i = run;
+
+        if (i == n)
+            break;
+
+        const unsigned char c = data[i++];
+
+        switch (c) {
+        case '"':
+            _out += "\\\"";
+            break;
+        case '\\':
+            _out += "\\\\";
+            break;
+        case '\n':
+            _out += "\\n";
+            break;
+        case '\r':
+            _out += "\\r";
+            break;
+        case '\t':
+            _out += "\\t";
+            break;
+        case '\b':
+            _out += "\\b";
+            break;
+        case '\f':
+            _out += "\\f";
+            break;
+        default:
+            _out += "\\u00";
+            _out += hex[c >> 4];
+            _out += hex[c & 0xF];
+        }
+    }
+
+    _out += '"';
+}
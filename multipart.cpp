@@ -0,0 +1,229 @@
+#include "h/multipart.h"
+#include "h/http.h"
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include "h/string_trim.h"
+
+
+using namespace http;
+
+MultipartParser::MultipartParser(const std::string& boundary, const Callbacks& callbacks):
+    _delimiter("\r\n--" + boundary), _callbacks(callbacks), _searcher(_delimiter.begin(), _delimiter.end()) {
+
+    if (boundary.empty() || boundary.size() > 70)
+        throw RequestError(400, "Invalid multipart boundary");
+
+    // the first boundary may directly follow the start of the body, without a preceding CRLF
+    _buffer = "\r\n";
+}
+
+size_t MultipartParser::findDelimiter(const size_t from) const {
+    const auto it = std::search(_buffer.begin() + from, _buffer.end(), _searcher);
+
+    return it == _buffer.end() ? std::string::npos : it - _buffer.begin();
+}
+
+void MultipartParser::emit(const char* data, const size_t n) {
+    if (n == 0)
+        return;
+
+    if (_spoolFd < 0) {
+        if (_callbacks.onData)
+            _callbacks.onData(data, n);
+        return;
+    }
+
+    size_t written = 0;
+
+    while (written < n) {
+        const ssize_t ret = write(_spoolFd, data + written, n - written);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "Writing multipart part to file failed");
+        }
+
+        written += ret;
+    }
+}
+
+MultipartPart MultipartParser::parsePart(const std::string& headers) {
+    MultipartPart part;
+    size_t start = 0;
+
+    while (start < headers.size()) {
+        size_t end = headers.find("\r\n", start);
+        if (end == std::string::npos)
+            end = headers.size();
+
+        const std::string line = headers.substr(start, end - start);
+        const size_t colon = line.find(':');
+
+        if (colon != std::string::npos) {
+            std::string key = line.substr(0, colon);
+            std::string value = line.substr(colon + 1);
+            trim(key);
+            trim(value);
+
+            std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return std::tolower(c); });
+            part.Fields[key] = value;
+        }
+
+        start = end + 2;
+    }
+
+    part.ContentType = part.Fields["content-type"];
+
+    // Content-Disposition: form-data; name="field"; filename="file.txt"
+    const std::string& disposition = part.Fields["content-disposition"];
+    size_t pos = 0;
+
+    while ((pos = disposition.find(';', pos)) != std::string::npos) {
+        pos++;
+        const size_t equals = disposition.find('=', pos);
+        if (equals == std::string::npos)
+            break;
+
+        std::string name = disposition.substr(pos, equals - pos);
+        trim(name);
+
+        std::string value;
+        size_t next = equals + 1;
+
+        if (next < disposition.size() && disposition[next] == '"') {
+            const size_t quote = disposition.find('"', next + 1);
+            value = disposition.substr(next + 1, quote == std::string::npos ? std::string::npos : quote - next - 1);
+            next = quote == std::string::npos ? disposition.size() : quote + 1;
+        } else {
+            const size_t semicolon = disposition.find(';', next);
+            value = disposition.substr(next, semicolon == std::string::npos ? std::string::npos : semicolon - next);
+            trim(value);
+            next = semicolon == std::string::npos ? disposition.size() : semicolon;
+        }
+
+        if (name == "name")
+            part.Name = value;
+        else if (name == "filename")
+            part.Filename = value;
+
+        pos = next;
+    }
+
+    return part;
+}
+
+void MultipartParser::feed(const char* data, const size_t n) {
+    if (_state == STATE::DONE)
+        return;
+
+    _buffer.append(data, n);
+    size_t pos = 0;
+
+    while (_state != STATE::DONE) {
+        if (_state == STATE::PREAMBLE) {
+            const size_t found = findDelimiter(pos);
+
+            if (found == std::string::npos) {
+                // discard the preamble but keep what could be the start of the delimiter
+                if (_buffer.size() - pos >= _delimiter.size())
+                    pos = _buffer.size() - _delimiter.size() + 1;
+                break;
+            }
+
+            pos = found + _delimiter.size();
+            _state = STATE::DELIMITER_END;
+
+        } else if (_state == STATE::DELIMITER_END) {
+            // "--" closes the body, otherwise optional whitespace and CRLF start the next part
+            if (_buffer.size() - pos < 2)
+                break;
+
+            if (_buffer.compare(pos, 2, "--") == 0) {
+                _state = STATE::DONE;
+                break;
+            }
+
+            const size_t lineEnd = _buffer.find("\r\n", pos);
+
+            if (lineEnd == std::string::npos) {
+                if (_buffer.size() - pos > 256)
+                    throw RequestError(400, "Invalid multipart boundary line");
+                break;
+            }
+
+            pos = lineEnd + 2;
+            _state = STATE::HEADERS;
+
+        } else if (_state == STATE::HEADERS) {
+            // a part without headers starts directly with the empty line
+            const size_t headersEnd = _buffer.compare(pos, 2, "\r\n") == 0 ? pos : _buffer.find("\r\n\r\n", pos);
+
+            if (headersEnd == std::string::npos) {
+                if (_buffer.size() - pos > MAX_HEADER_SIZE)
+                    throw RequestError(413, "Multipart part headers too large");
+                break;
+            }
+
+            const MultipartPart part = parsePart(_buffer.substr(pos, headersEnd - pos));
+            _spoolFd = _callbacks.onPart ? _callbacks.onPart(part) : -1;
+
+            pos = headersEnd + (headersEnd == pos ? 2 : 4);
+            _state = STATE::DATA;
+
+        } else if (_state == STATE::DATA) {
+            const size_t found = findDelimiter(pos);
+
+            if (found == std::string::npos) {
+                // everything except a possible partial delimiter at the end belongs to the part
+                const size_t keep = _delimiter.size() - 1;
+
+                if (_buffer.size() - pos > keep) {
+                    emit(_buffer.data() + pos, _buffer.size() - pos - keep);
+                    pos = _buffer.size() - keep;
+                }
+                break;
+            }
+
+            emit(_buffer.data() + pos, found - pos);
+
+            if (_callbacks.onPartEnd)
+                _callbacks.onPartEnd();
+
+            _spoolFd = -1;
+            pos = found + _delimiter.size();
+            _state = STATE::DELIMITER_END;
+        }
+    }
+
+    _buffer.erase(0, pos);
+
+    // the epilogue after the closing boundary is ignored
+    if (_state == STATE::DONE)
+        _buffer.clear();
+}
+
+std::string MultipartParser::boundaryOf(const std::string& contentType) {
+    const size_t pos = contentType.find("boundary=");
+
+    if (pos == std::string::npos)
+        return "";
+
+    std::string boundary = contentType.substr(pos + 9);
+
+    if (! boundary.empty() && boundary[0] == '"') {
+        const size_t quote = boundary.find('"', 1);
+        return boundary.substr(1, quote == std::string::npos ? std::string::npos : quote - 1);
+    }
+
+    const size_t semicolon = boundary.find(';');
+    boundary = boundary.substr(0, semicolon);
+    trim(boundary);
+
+    return boundary;
+}
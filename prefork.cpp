@@ -0,0 +1,416 @@
+#include "h/prefork.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <limits.h>
+
+
+const char* prefork::LISTEN_FDS_ENV = "WEBSERVER_LISTEN_FDS";
+const char* prefork::PARENT_PID_ENV = "WEBSERVER_PARENT_PID";
+
+static volatile sig_atomic_t stopRequested = 0;
+static volatile sig_atomic_t quitRequested = 0;
+static volatile sig_atomic_t upgradeRequested = 0;
+
+/// @brief The running flag of the worker in this process (worker processes only)
+static std::atomic_bool* workerRunning = nullptr;
+
+/// @brief The worker's end of the message channel to the supervisor (worker processes only)
+static int workerChannel = -1;
+
+/// @brief A worker process and the supervisor's end of its message channel
+struct Worker {
+    pid_t pid = -1;
+    int channel = -1;
+};
+
+static void supervisorSignalHandler(int signal) {
+    switch (signal) {
+    case SIGQUIT:
+        quitRequested = 1;
+        break;
+    case SIGUSR2:
+        upgradeRequested = 1;
+        break;
+    case SIGCHLD:
+        // only interrupts ppoll, the children are reaped in the main loop
+        break;
+    default:
+        stopRequested = 1;
+    }
+}
+
+static void workerSignalHandler(int) {
+    // storing to a lock-free atomic is async-signal-safe
+    if (workerRunning != nullptr)
+        workerRunning->store(false);
+}
+
+static void installHandler(const int signal, void (*handler)(int)) {
+    struct sigaction action = {};
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(signal, &action, nullptr);
+}
+
+static const int supervisorSignals[] = { SIGTERM, SIGINT, SIGQUIT, SIGUSR2, SIGCHLD };
+
+std::vector<int> prefork::inheritedListeners() {
+    std::vector<int> fds;
+    const char* value = getenv(LISTEN_FDS_ENV);
+
+    if (value == nullptr)
+        return fds;
+
+    std::stringstream ss(value);
+    std::string fd;
+
+    while (std::getline(ss, fd, ',')) {
+        const int n = atoi(fd.c_str());
+
+        if (fd.empty() || fcntl(n, F_GETFD) < 0) {
+            std::cerr << "prefork: ignoring invalid inherited listener '" << fd << "'" << std::endl;
+            continue;
+        }
+
+        // do not leak the listener into unrelated child processes
+        fcntl(n, F_SETFD, FD_CLOEXEC);
+        fds.push_back(n);
+    }
+
+    unsetenv(LISTEN_FDS_ENV);
+    return fds;
+}
+
+bool prefork::publish(const std::string& message) {
+    if (workerChannel < 0)
+        return false;
+
+    if (message.size() > MAX_MESSAGE_SIZE)
+        throw std::runtime_error("prefork: message too large");
+
+    while (send(workerChannel, message.data(), message.size(), MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR) {
+            perror("prefork: publish");
+            break;
+        }
+    }
+
+    return true;
+}
+
+/// @brief Receives the messages published by the other workers until running is false (worker processes only)
+static void receiveMessages(std::atomic_bool& running, const std::function<void(const std::string&)>& onMessage) {
+    std::vector<char> buffer(prefork::MAX_MESSAGE_SIZE);
+
+    while (running) {
+        pollfd fd = { workerChannel, POLLIN, 0 };
+        if (poll(&fd, 1, 50) <= 0)
+            continue;
+
+        const ssize_t n = recv(workerChannel, buffer.data(), buffer.size(), MSG_DONTWAIT);
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            break;
+        }
+
+        // an empty message is only the end of the channel if the supervisor is gone
+        if (n == 0 && (fd.revents & (POLLHUP | POLLERR)))
+            break;
+
+        if (onMessage)
+            onMessage(std::string(buffer.data(), n));
+    }
+}
+
+/// @brief Forwards the messages published by a worker to all other workers
+/// @param polled the polled channels, in the same order as the workers
+static void relayMessages(std::vector<Worker>& workers, const std::vector<pollfd>& polled) {
+    static std::vector<char> buffer(prefork::MAX_MESSAGE_SIZE);
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (polled[i].revents == 0 || workers[i].channel < 0)
+            continue;
+
+        const ssize_t n = recv(workers[i].channel, buffer.data(), buffer.size(), MSG_DONTWAIT);
+
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+
+        if (n < 0 || (n == 0 && (polled[i].revents & (POLLHUP | POLLERR)))) {
+            // the worker exited, it gets a new channel when it is restarted
+            close(workers[i].channel);
+            workers[i].channel = -1;
+            continue;
+        }
+
+        for (size_t j = 0; j < workers.size(); j++) {
+            if (j == i || workers[j].channel < 0)
+                continue;
+
+            // never block the supervisor on a worker that does not read its messages
+            if (send(workers[j].channel, buffer.data(), n, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+                std::cerr << "prefork: dropped message for worker " << workers[j].pid << std::endl;
+        }
+    }
+}
+
+/// @brief Forks a worker process with a message channel to the supervisor
+static void spawnWorker(Worker& slot, const std::vector<Worker>& workers, const std::vector<int>& fds, const sigset_t& originalMask, const std::function<void(const std::vector<int>&, std::atomic_bool&)>& worker, const std::function<void(const std::string&)>& onMessage) {
+    int channel[2] = { -1, -1 };
+
+    // a message is received in one piece or not at all
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, channel) < 0)
+        perror("prefork: socketpair");
+
+    const pid_t pid = fork();
+
+    if (pid != 0) {
+        if (pid < 0)
+            perror("prefork: fork");
+
+        if (channel[1] >= 0)
+            close(channel[1]);
+
+        if (pid < 0 && channel[0] >= 0) {
+            close(channel[0]);
+            channel[0] = -1;
+        }
+
+        slot.pid = pid;
+        slot.channel = channel[0];
+        return;
+    }
+
+    // worker process, only its own end of the channel stays open
+    for (const Worker& other : workers)
+        if (other.channel >= 0)
+            close(other.channel);
+
+    if (channel[0] >= 0)
+        close(channel[0]);
+
+    workerChannel = channel[1];
+
+    std::atomic_bool running(true);
+    workerRunning = &running;
+
+    installHandler(SIGTERM, workerSignalHandler);
+    installHandler(SIGINT, workerSignalHandler);
+    installHandler(SIGQUIT, workerSignalHandler);
+    installHandler(SIGUSR2, SIG_DFL);
+    installHandler(SIGCHLD, SIG_DFL);
+    // a client closing its connection early must not kill the worker
+    installHandler(SIGPIPE, SIG_IGN);
+    sigprocmask(SIG_SETMASK, &originalMask, nullptr);
+
+    std::thread* receiver = workerChannel >= 0 ? new std::thread([&running, &onMessage]() { receiveMessages(running, onMessage); }) : nullptr;
+
+    worker(fds, running);
+
+    if (receiver != nullptr) {
+        receiver->join();
+        delete receiver;
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+/// @brief Resolves the path of the executable of this process
+/// @details Must be called before the file can be replaced, /proc/self/exe keeps pointing to the old file afterwards
+static std::string executablePath() {
+    char path[PATH_MAX];
+    const ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+
+    if (n < 0) {
+        perror("prefork: readlink /proc/self/exe");
+        return "";
+    }
+
+    return std::string(path, n);
+}
+
+/// @brief Starts the executable at the given path, handing over the listening sockets
+static pid_t spawnGeneration(const std::string& executable, const std::vector<int>& fds, const sigset_t& originalMask) {
+    const pid_t pid = fork();
+
+    if (pid != 0) {
+        if (pid < 0)
+            perror("prefork: fork");
+        return pid;
+    }
+
+    std::string value = "";
+
+    for (const int fd : fds) {
+        fcntl(fd, F_SETFD, 0);
+        value += (value.empty() ? "" : ",") + std::to_string(fd);
+    }
+
+    setenv(prefork::LISTEN_FDS_ENV, value.c_str(), 1);
+    setenv(prefork::PARENT_PID_ENV, std::to_string(getppid()).c_str(), 1);
+
+    // restore the command line of the current process, including the original argv[0]
+    std::ifstream cmdline("/proc/self/cmdline");
+    std::vector<std::string> args;
+    std::string arg;
+
+    while (std::getline(cmdline, arg, '\0'))
+        args.push_back(arg);
+
+    std::vector<char*> argv;
+    for (std::string& a : args)
+        argv.push_back(&a[0]);
+    argv.push_back(nullptr);
+
+    for (const int signal : supervisorSignals)
+        installHandler(signal, SIG_DFL);
+    sigprocmask(SIG_SETMASK, &originalMask, nullptr);
+
+    execv(executable.c_str(), argv.data());
+
+    perror("prefork: execv");
+    _exit(127);
+}
+
+int prefork::supervise(const std::vector<tcp::ListenAddress>& addresses, const tcp::SocketProfile& profile, const Options& options, const std::function<void(const std::vector<int>&, std::atomic_bool&)>& worker, const std::function<void(const std::string&)>& onMessage) {
+    std::vector<int> fds = inheritedListeners();
+    const bool inherited = ! fds.empty();
+
+    // resolved now, a binary upgrade replaces the file before the executable is started again
+    const std::string executable = options.executable.empty() ? executablePath() : options.executable;
+
+    if (! inherited) {
+        fds = tcp::bindListeners(addresses, profile);
+
+        if (fds.empty() && ! addresses.empty())
+            return EXIT_FAILURE;
+    }
+
+    // block the handled signals outside of ppoll so none of them can be missed
+    sigset_t handled, originalMask;
+    sigemptyset(&handled);
+    for (const int signal : supervisorSignals) {
+        sigaddset(&handled, signal);
+        installHandler(signal, supervisorSignalHandler);
+    }
+    sigprocmask(SIG_BLOCK, &handled, &originalMask);
+
+    const unsigned int n = options.workers > 0 ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<Worker> workers(n);
+
+    for (Worker& w : workers)
+        spawnWorker(w, workers, fds, originalMask, worker, onMessage);
+
+    // the workers of this generation are running, let the previous generation drain
+    const char* parentPid = getenv(PARENT_PID_ENV);
+    if (inherited && parentPid != nullptr) {
+        kill(atoi(parentPid), SIGQUIT);
+        unsetenv(PARENT_PID_ENV);
+    }
+
+    pid_t nextGeneration = -1;
+
+    while (! stopRequested && ! quitRequested) {
+        // wait for a signal or a message published by a worker
+        std::vector<pollfd> polled;
+        for (const Worker& w : workers)
+            polled.push_back({ w.channel, POLLIN, 0 });
+
+        if (ppoll(polled.data(), polled.size(), nullptr, &originalMask) > 0)
+            relayMessages(workers, polled);
+
+        int status;
+        pid_t pid;
+
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            if (pid == nextGeneration) {
+                std::cerr << "prefork: upgrade failed, new generation exited" << std::endl;
+                nextGeneration = -1;
+                continue;
+            }
+
+            for (Worker& w : workers) {
+                if (w.pid != pid)
+                    continue;
+
+                if (WIFSIGNALED(status))
+                    std::cerr << "prefork: worker " << pid << " killed by signal " << WTERMSIG(status) << ", restarting" << std::endl;
+                else
+                    std::cerr << "prefork: worker " << pid << " exited with status " << WEXITSTATUS(status) << ", restarting" << std::endl;
+
+                w.pid = -1;
+
+                if (w.channel >= 0) {
+                    close(w.channel);
+                    w.channel = -1;
+                }
+
+                if (! stopRequested && ! quitRequested) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(options.restartDelayMs));
+                    spawnWorker(w, workers, fds, originalMask, worker, onMessage);
+                }
+            }
+        }
+
+        if (upgradeRequested) {
+            upgradeRequested = 0;
+
+            if (nextGeneration > 0)
+                std::cerr << "prefork: upgrade already in progress" << std::endl;
+            else
+                nextGeneration = spawnGeneration(executable, fds, originalMask);
+        }
+    }
+
+    // stop the workers, they finish their connections before exiting
+    for (const Worker& w : workers)
+        if (w.pid > 0)
+            kill(w.pid, SIGTERM);
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.shutdownTimeoutMs);
+
+    for (Worker& w : workers) {
+        pid_t& pid = w.pid;
+
+        while (pid > 0) {
+            if (waitpid(pid, nullptr, WNOHANG) != 0) {
+                pid = -1;
+            } else if (std::chrono::steady_clock::now() >= deadline) {
+                kill(pid, SIGKILL);
+                waitpid(pid, nullptr, 0);
+                pid = -1;
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        if (w.channel >= 0)
+            close(w.channel);
+    }
+
+    // the listeners are still in use if a new generation took over
+    const bool handedOver = quitRequested && nextGeneration > 0;
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        close(fds[i]);
+
+        if (! handedOver && i < addresses.size() && addresses[i].family == tcp::FAMILY::UNIX)
+            unlink(addresses[i].path.c_str());
+    }
+
+    sigprocmask(SIG_SETMASK, &originalMask, nullptr);
+
+    return EXIT_SUCCESS;
+}
@@ -1,5 +1,7 @@
-#include "h/http/server.h"
+#include "h/server.h"
 #include <stdexcept>
+#include <chrono>
+#include "h/string_trim.h"
 
 
 int HTTPServer::maxConnections = 10;
@@ -8,7 +10,7 @@ HTTPServer::HTTPServer() {
     root = new Endpoint("/");
 }
 
-void HTTPServer::addRoute(const std::string& route, const HTTP_METHOD method, std::function<http::Response(const http::Request&)> callback) {
+void HTTPServer::addRoute(const std::string& route, const HTTP_METHOD method, std::function<http::Response(const http::Request&, WorkerContext&)> callback) {
     const std::vector<std::string> splitRoute = Endpoint::split(route);
     const int n = splitRoute.size();
 
@@ -52,31 +54,144 @@ void HTTPServer::addRoute(const std::string& route, const HTTP_METHOD method, st
     }
 }
 
+Endpoint* HTTPServer::getEndpoint(const std::string& route) const {
+    Endpoint* current = root;
+
+    for (const std::string& routePart : Endpoint::split(route)) {
+        current = (*current)[routePart];
+
+        if (current == nullptr)
+            throw std::runtime_error("Route '" + route + "' does not exist");
+    }
+
+    return current;
+}
+
+void HTTPServer::addValidator(const std::string& route, const HTTP_METHOD method, std::function<std::string(const http::Request&)> validator) {
+    getEndpoint(route)->addValidator(method, validator);
+}
+
+void HTTPServer::coalesce(const std::string& route, const std::vector<std::string>& headers) {
+    std::vector<std::string> fields;
+
+    for (std::string header : headers) {
+        std::transform(header.begin(), header.end(), header.begin(), [](unsigned char c) { return std::tolower(c); });
+        fields.push_back(header);
+    }
+
+    getEndpoint(route)->setCoalescing(HTTP_METHOD::GET, fields);
+}
+
+/// @brief Adapts a callback without worker context to the signature used by the endpoints
+static std::function<http::Response(const http::Request&, WorkerContext&)> withContext(std::function<http::Response(const http::Request&)> callback) {
+    return [callback](const http::Request& req, WorkerContext&) { return callback(req); };
+}
+
 void HTTPServer::GET(const std::string& route, std::function<http::Response(const http::Request&)> callback) {
+    addRoute(route, HTTP_METHOD::GET, withContext(callback));
+}
+
+void HTTPServer::GET(const std::string& route, std::function<http::Response(const http::Request&, WorkerContext&)> callback) {
     addRoute(route, HTTP_METHOD::GET, callback);
 }
 
+void HTTPServer::GET(const std::string& route, std::function<std::string(const http::Request&)> validator, std::function<http::Response(const http::Request&)> callback) {
+    GET(route, validator, withContext(callback));
+}
+
+void HTTPServer::GET(const std::string& route, std::function<std::string(const http::Request&)> validator, std::function<http::Response(const http::Request&, WorkerContext&)> callback) {
+    addRoute(route, HTTP_METHOD::GET, callback);
+    addValidator(route, HTTP_METHOD::GET, validator);
+}
+
 void HTTPServer::POST(const std::string& route, std::function<http::Response(const http::Request&)> callback) {
+    addRoute(route, HTTP_METHOD::POST, withContext(callback));
+}
+
+void HTTPServer::POST(const std::string& route, std::function<http::Response(const http::Request&, WorkerContext&)> callback) {
+    addRoute(route, HTTP_METHOD::POST, callback);
+}
+
+void HTTPServer::POST(const std::string& route, std::function<http::MultipartParser::Callbacks(const http::Request&)> upload, std::function<http::Response(const http::Request&)> callback) {
+    POST(route, upload, withContext(callback));
+}
+
+void HTTPServer::POST(const std::string& route, std::function<http::MultipartParser::Callbacks(const http::Request&)> upload, std::function<http::Response(const http::Request&, WorkerContext&)> callback) {
     addRoute(route, HTTP_METHOD::POST, callback);
+    getEndpoint(route)->addUpload(HTTP_METHOD::POST, upload);
 }
 
 void HTTPServer::PUT(const std::string& route, std::function<http::Response(const http::Request&)> callback) {
+    addRoute(route, HTTP_METHOD::PUT, withContext(callback));
+}
+
+void HTTPServer::PUT(const std::string& route, std::function<http::Response(const http::Request&, WorkerContext&)> callback) {
     addRoute(route, HTTP_METHOD::PUT, callback);
 }
 
 void HTTPServer::DELETE(const std::string& route, std::function<http::Response(const http::Request&)> callback) {
+    addRoute(route, HTTP_METHOD::DELETE, withContext(callback));
+}
+
+void HTTPServer::DELETE(const std::string& route, std::function<http::Response(const http::Request&, WorkerContext&)> callback) {
     addRoute(route, HTTP_METHOD::DELETE, callback);
 }
 
 std::thread* HTTPServer::start(const int port, std::atomic_bool* running) {
+    return start(std::vector<tcp::ListenAddress>{ tcp::ipv4Address(port) }, running);
+}
+
+std::thread* HTTPServer::start(const std::vector<tcp::ListenAddress>& addresses, std::atomic_bool* running) {
+    // bind in the calling thread so configuration errors reach the caller
+    const std::vector<int> fds = tcp::bindListeners(addresses, this->socketProfile);
+
+    if (fds.empty() && ! addresses.empty())
+        throw std::runtime_error("Cannot listen on the given addresses");
+
+    if (this->accessLogOptions && this->accessLog == nullptr) {
+        try {
+            this->accessLog = new AccessLog(*this->accessLogOptions);
+        } catch (...) {
+            tcp::closeListeners(fds, addresses);
+            throw;
+        }
+    }
+
+    createWorkerContexts();
+
     // start listener
-    std::thread* listen = new std::thread([this, port, running]() {
-        tcp::openListener(port, HTTPServer::maxConnections, tcpConnectionRequestHandler, this, *running);
+    std::thread* listen = new std::thread([this, addresses, fds, running]() {
+        tcp::serveListeners(fds, this->socketProfile, tcpConnectionRequestHandler, tcpConnectionCapacityHandler, this, *running);
+        tcp::closeListeners(fds, addresses);
     });
     
     return listen;
 }
 
+int HTTPServer::serve(const std::vector<tcp::ListenAddress>& addresses, const prefork::Options& options) {
+    return prefork::supervise(addresses, this->socketProfile, options, [this](const std::vector<int>& listeners, std::atomic_bool& running) {
+        // only the workers log, each to its own file so every log is rotated by a single process
+        if (this->accessLogOptions) {
+            AccessLog::Options options = *this->accessLogOptions;
+            options.path += "." + std::to_string(getpid());
+
+            try {
+                this->accessLog = new AccessLog(options);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << ", the worker runs without access log" << std::endl;
+            }
+        }
+
+        createWorkerContexts();
+
+        tcp::serveListeners(listeners, this->socketProfile, tcpConnectionRequestHandler, tcpConnectionCapacityHandler, this, running);
+        stop();
+    }, [this](const std::string& message) {
+        // published by another worker process
+        this->deliverToWorkers(message);
+    });
+}
+
 void HTTPServer::stop() {
     std::lock_guard<std::mutex> lock(tcpConnections_mutex);
 
@@ -87,13 +202,133 @@ void HTTPServer::stop() {
     }
 
     delete this->root;
+
+    delete this->accessLog;
+    this->accessLog = nullptr;
+
+    delete this->tracer;
+    this->tracer = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(workerContexts_mutex);
+
+        for (WorkerContext* context : this->workerContexts)
+            delete context;
+
+        this->workerContexts.clear();
+        this->idleWorkerContexts.clear();
+    }
+}
+
+void HTTPServer::createWorkerContexts() {
+    std::lock_guard<std::mutex> lock(workerContexts_mutex);
+
+    // one context for every connection that can be handled at the same time
+    while (this->workerContexts.size() < (size_t) HTTPServer::maxConnections) {
+        WorkerContext* context = new WorkerContext(this->workerContexts.size(), this->workerSlotFactories);
+        this->workerContexts.push_back(context);
+        this->idleWorkerContexts.push_back(context);
+    }
+}
+
+WorkerContext* HTTPServer::acquireWorkerContext() {
+    std::lock_guard<std::mutex> lock(workerContexts_mutex);
+
+    if (this->idleWorkerContexts.empty()) {
+        // more connections than expected are running, add another worker
+        WorkerContext* context = new WorkerContext(this->workerContexts.size(), this->workerSlotFactories);
+        this->workerContexts.push_back(context);
+        return context;
+    }
+
+    // take the context idle for the longest time, so every context is used regularly
+    WorkerContext* context = this->idleWorkerContexts.front();
+    this->idleWorkerContexts.pop_front();
+    return context;
+}
+
+void HTTPServer::releaseWorkerContext(WorkerContext* context) {
+    std::lock_guard<std::mutex> lock(workerContexts_mutex);
+    this->idleWorkerContexts.push_back(context);
+}
+
+void HTTPServer::onWorkerMessage(std::function<void(WorkerContext&, const std::string&)> handler) {
+    this->workerMessageHandler = handler;
+}
+
+void HTTPServer::broadcast(const std::string& message) {
+    deliverToWorkers(message);
+
+    // the other worker processes in prefork mode
+    prefork::publish(message);
+}
+
+void HTTPServer::deliverToWorkers(const std::string& message) {
+    std::deque<WorkerContext*> idle;
+
+    {
+        std::lock_guard<std::mutex> lock(workerContexts_mutex);
+
+        for (WorkerContext* context : this->workerContexts)
+            context->post(message);
+
+        // take the idle contexts like a connection would, so the handler runs without holding the mutex
+        idle.swap(this->idleWorkerContexts);
+    }
+
+    // deliver now instead of letting the inboxes of idle contexts grow
+    for (WorkerContext* context : idle)
+        context->deliver(this->workerMessageHandler);
+
+    std::lock_guard<std::mutex> lock(workerContexts_mutex);
+    this->idleWorkerContexts.insert(this->idleWorkerContexts.end(), idle.begin(), idle.end());
+}
+
+void HTTPServer::setSocketProfile(const tcp::SocketProfile& profile) {
+    this->socketProfile = profile;
+}
+
+void HTTPServer::enableTracing(const tracing::Options& options, const std::string& adminRoute) {
+    if (this->tracer != nullptr)
+        throw std::runtime_error("Tracing already enabled");
+
+    this->tracer = new tracing::Tracer(options);
+
+    if (adminRoute.empty())
+        return;
+
+    GET(adminRoute, [this](const http::Request&) {
+        http::Response res;
+
+        res.header.StatusCode = 200;
+        res.header.StatusMessage = "OK";
+        res.header.ContentType = CONTENT_TYPE::JSON;
+        res.header.Version = "HTTP/1.1";
+        res.header.Connection = "close";
+
+        res.body.data = this->tracer->dumpChromeTrace(this->tracer->options().dumpSeconds);
+
+        return res;
+    });
+}
+
+void HTTPServer::setRequestLimits(const http::RequestLimits& limits) {
+    this->requestLimits = limits;
+}
+
+void HTTPServer::enableAccessLog(const AccessLog::Options& options) {
+    if (this->accessLogOptions)
+        throw std::runtime_error("Access log already enabled");
+
+    // opened by start or by the workers of serve
+    this->accessLogOptions = options;
 }
 
 HTTPServer::~HTTPServer() {
     stop();
 }
 
-void HTTPServer::tcpConnectionRequestHandler(const sockaddr_in address, HTTPServer* s, const int socketid) {
+void HTTPServer::tcpConnectionRequestHandler(const sockaddr_storage& address, HTTPServer* s, const int socketid) {
 
     {
         std::lock_guard<std::mutex> lock(s->tcpConnections_mutex);
@@ -112,10 +347,8 @@ void HTTPServer::tcpConnectionRequestHandler(const sockaddr_in address, HTTPServ
         }
     }
 
-    // check if max connections is reached
-    if (s->tcpConnections.size() >= HTTPServer::maxConnections) {
-        return;
-    }
+    // the listener only accepts a connection if tcpConnectionCapacityHandler reported a free slot
+    s->activeConnections++;
 
     {
         std::lock_guard<std::mutex> lock(s->tcpConnections_mutex);
@@ -127,13 +360,20 @@ void HTTPServer::tcpConnectionRequestHandler(const sockaddr_in address, HTTPServ
     }
 }
 
-http::Response HTTPServer::processHTTPRequest(const http::Request& req) const {
+bool HTTPServer::tcpConnectionCapacityHandler(HTTPServer* s) {
+    std::unique_lock<std::mutex> lock(s->connectionFinished_mutex);
+
+    // pending connections stay in the listen backlog (or go to another worker) until a slot is free
+    return s->connectionFinished.wait_for(lock, std::chrono::milliseconds(50), [s]() { return s->activeConnections < HTTPServer::maxConnections; });
+}
+
+const Endpoint* HTTPServer::findEndpoint(const http::Request& req) const {
     const std::vector<std::string> splitRoute = Endpoint::split(req.header.Path);
     const int n = splitRoute.size();
 
     if (req.header.Path == "/" && n == 0) {
         if (root->hasCallbackFor(req.header.Method))
-            return root->getCallback(req.header.Method)(req);
+            return root;
     } else {
         const Endpoint* current = root;
 
@@ -144,7 +384,7 @@ http::Response HTTPServer::processHTTPRequest(const http::Request& req) const {
                 // last route part
 
                 if (current->hasChildRoute(routePart) && (*current)[routePart]->hasCallbackFor(req.header.Method))
-                    return (*current)[routePart]->getCallback(req.header.Method)(req);
+                    return (*current)[routePart];
                 else
                     break;
 
@@ -158,6 +398,85 @@ http::Response HTTPServer::processHTTPRequest(const http::Request& req) const {
             }
         }
     }
+
+    return nullptr;
+}
+
+/// @brief Wraps the value returned by a validator in quotes if it is not already a valid entity tag
+static std::string quoteETag(const std::string& value) {
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+        return value;
+
+    if (value.size() >= 4 && value.compare(0, 3, "W/\"") == 0 && value.back() == '"')
+        return value;
+
+    return "\"" + value + "\"";
+}
+
+/// @brief Checks if the If-None-Match header matches the given entity tag (weak comparison)
+static bool matchesETag(const std::string& ifNoneMatch, const std::string& etag) {
+    if (ifNoneMatch.empty())
+        return false;
+
+    const std::string opaqueTag = etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag;
+    size_t start = 0;
+
+    while (start <= ifNoneMatch.size()) {
+        size_t end = ifNoneMatch.find(',', start);
+        if (end == std::string::npos)
+            end = ifNoneMatch.size();
+
+        std::string candidate = ifNoneMatch.substr(start, end - start);
+        trim(candidate);
+
+        if (candidate == "*")
+            return true;
+
+        if (candidate.compare(0, 2, "W/") == 0)
+            candidate.erase(0, 2);
+
+        if (candidate == opaqueTag)
+            return true;
+
+        start = end + 1;
+    }
+
+    return false;
+}
+
+http::Response HTTPServer::processHTTPRequest(const http::Request& req, WorkerContext& context) const {
+    return processHTTPRequest(req, findEndpoint(req), context);
+}
+
+http::Response HTTPServer::processHTTPRequest(const http::Request& req, const Endpoint* endpoint, WorkerContext& context) const {
+    tracing::Span span(tracing::PHASE::CALLBACK);
+
+    if (endpoint != nullptr) {
+        if (! endpoint->hasValidatorFor(req.header.Method))
+            return endpoint->getCallback(req.header.Method)(req, context);
+
+        const std::string etag = quoteETag(endpoint->getValidator(req.header.Method)(req));
+
+        if (matchesETag(req.header.IfNoneMatch, etag)) {
+            // the client already has the current version, skip the callback
+            http::Response res;
+
+            res.header.StatusCode = 304;
+            res.header.StatusMessage = "Not Modified";
+            res.header.Version = "HTTP/1.1";
+            res.header.Connection = "close";
+            res.header.ETag = etag;
+
+            return res;
+        }
+
+        http::Response res = endpoint->getCallback(req.header.Method)(req, context);
+
+        if (res.header.ETag.empty() && res.header.StatusCode >= 200 && res.header.StatusCode < 300)
+            res.header.ETag = etag;
+
+        return res;
+    }
     
     // If no route was found, return 404
 
@@ -174,7 +493,112 @@ http::Response HTTPServer::processHTTPRequest(const http::Request& req) const {
     return res;
 }
 
+std::shared_ptr<const http::SerializedResponse> HTTPServer::handleHTTPRequest(const http::Request& req, WorkerContext& context) {
+    context.deliver(this->workerMessageHandler);
+
+    tracing::Span routing(tracing::PHASE::ROUTE);
+    const Endpoint* endpoint = findEndpoint(req);
+    routing.end();
+
+    const auto respond = [this, &req, endpoint, &context]() {
+        http::Response res = processHTTPRequest(req, endpoint, context);
+
+        tracing::Span span(tracing::PHASE::SERIALIZE);
+        return http::serializeHTTPResponseParts(std::move(res));
+    };
+
+    if (endpoint == nullptr || ! endpoint->isCoalesced(req.header.Method))
+        return std::make_shared<const http::SerializedResponse>(respond());
+
+    // the conditional request header changes the response, so it is always part of the key
+    std::string key = req.header.Path + "\n" + req.header.IfNoneMatch;
+
+    for (const std::string& header : endpoint->getCoalescingHeaders(req.header.Method)) {
+        auto it = req.header.Fields.find(header);
+        key += "\n" + header + ":" + (it != req.header.Fields.end() ? it->second : "");
+    }
+
+    return singleFlight.run(key, respond);
+}
+
+/// @brief Finds the end of the header of a request
+/// @return the length of the header including the empty line or npos if it is incomplete
+static size_t headerLengthOf(const std::string& data) {
+    const size_t crlf = data.find("\r\n\r\n");
+    if (crlf != std::string::npos)
+        return crlf + 4;
+
+    const size_t lf = data.find("\n\n");
+    return lf == std::string::npos ? std::string::npos : lf + 2;
+}
+
+/// @brief Reads the status code from the status line of a serialized response
+static unsigned int statusCodeOf(const std::string& response) {
+    const size_t space = response.find(' ');
+    return space == std::string::npos ? 0 : strtoul(response.c_str() + space + 1, nullptr, 10);
+}
+
+/// @brief Creates the response for a request rejected before it reached a callback
+static http::Response errorResponse(const unsigned int statusCode) {
+    http::Response res;
+
+    res.header.StatusCode = statusCode;
+    res.header.ContentType = CONTENT_TYPE::TEXT;
+    res.header.Version = "HTTP/1.1";
+    res.header.Connection = "close";
+
+    switch (statusCode) {
+    case 400:
+        res.header.StatusMessage = "Bad Request";
+        break;
+    case 408:
+        res.header.StatusMessage = "Request Timeout";
+        break;
+    case 413:
+        res.header.StatusMessage = "Content Too Large";
+        break;
+    case 431:
+        res.header.StatusMessage = "Request Header Fields Too Large";
+        break;
+    default:
+        res.header.StatusMessage = "Internal Server Error";
+    }
+
+    res.body.data = res.header.StatusMessage + "\r\n";
+
+    return res;
+}
+
+/// @brief Reads and discards what the client still sends after its request was rejected,
+/// closing a socket with unread data would reset the connection before the client read the response
+static void discardRemainingRequest(const int socket) {
+    shutdown(socket, SHUT_WR);
+
+    char buffer[16 * 1024];
+    size_t discarded = 0;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+    while (discarded < 1024 * 1024 && std::chrono::steady_clock::now() < deadline) {
+        const int n = tcp::rcv(socket, buffer, sizeof(buffer), 100);
+        if (n <= 0)
+            break;
+        discarded += n;
+    }
+}
+
 void HTTPServer::HTTPConnectionHandler(TCP_CONN_INFO* info) {
+    const auto receivedAt = std::chrono::system_clock::now();
+    const auto receiveStart = std::chrono::steady_clock::now();
+
+    tracing::Trace trace;
+
+    if (this->tracer != nullptr) {
+        trace.begin[(size_t) tracing::PHASE::DISPATCH] = std::chrono::duration_cast<std::chrono::nanoseconds>(info->Accepted().time_since_epoch()).count();
+        trace.end[(size_t) tracing::PHASE::DISPATCH] = tracing::now();
+        tracing::attach(&trace);
+    }
+
+    tracing::Span receiving(tracing::PHASE::RECEIVE);
 
     struct timeval tv;
     tv.tv_sec = 0;
@@ -191,43 +615,186 @@ void HTTPServer::HTTPConnectionHandler(TCP_CONN_INFO* info) {
     } else if (select_ret == 0) {
         // timeout
     } else {
-        const int bufferSize = 2048;
-        char buffer[bufferSize] = {0};
+        const int bufferSize = 16 * 1024;
+        char buffer[bufferSize];
 
         std::string data = "";
 
+        // set once the end of the header was received
+        size_t headerLength = std::string::npos;
+        size_t contentLength = std::string::npos;
+
+        // the parsed header and the parser of a streamed multipart upload
+        http::Request head;
+        http::MultipartParser* upload = nullptr;
+        size_t uploaded = 0;
+
+        // set if the request is rejected before it reaches a callback
+        unsigned int rejectStatus = 0;
+
+        // the whole request must arrive before the deadline, so slow clients cannot hold a connection slot
+        const auto deadline = receiveStart + std::chrono::milliseconds(this->requestLimits.timeoutMs);
+
+        // once the length of the body is known, slow clients get more time between chunks
+        int timeoutMs = 100;
         int n = 0;
 
-        while ((n = tcp::rcv(info->Socket(), buffer, bufferSize) ) > 0) {
-            if (n == -1)
-                throw std::runtime_error("Error");
-            
-            if (n == 0)
-                break;
-
-            data += buffer;
-
-            // detect end of request
-            if(buffer[n-1] == '\n')
-                break;
-            
-            // detect end of request if no \n is found
-            if(n!=bufferSize) 
-                break;
-
-            for (int i = 0; i < bufferSize; i++)
-                buffer[i] = 0;
+        try {
+            while (true) {
+                const auto remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+                if (remainingMs <= 0 || (n = tcp::rcv(info->Socket(), buffer, bufferSize, std::min<long long>(timeoutMs, remainingMs))) <= 0)
+                    break;
+
+                if (upload != nullptr) {
+                    // stream the body of the upload instead of buffering it
+                    upload->feed(buffer, n);
+                    uploaded += n;
+                } else {
+                    data.append(buffer, n);
+
+                    if (headerLength == std::string::npos && (headerLength = headerLengthOf(data)) != std::string::npos) {
+                        head = http::parseHTTPHeader(data.substr(0, headerLength));
+
+                        auto length = head.header.Fields.find("content-length");
+                        if (length != head.header.Fields.end()) {
+                            contentLength = strtoull(length->second.c_str(), nullptr, 10);
+                            timeoutMs = this->requestLimits.idleTimeoutMs;
+                        }
+
+                        const Endpoint* endpoint = findEndpoint(head);
+
+                        if (endpoint != nullptr && endpoint->hasUploadFor(head.header.Method) && head.header.ContentType == CONTENT_TYPE::MULTIPART_FORM_DATA) {
+                            upload = new http::MultipartParser(http::MultipartParser::boundaryOf(head.header.Fields["content-type"]), endpoint->getUpload(head.header.Method)(head));
+                            uploaded = data.size() - headerLength;
+                            upload->feed(data.data() + headerLength, uploaded);
+                            data.erase(headerLength);
+                        } else if (contentLength != std::string::npos && contentLength > this->requestLimits.maxBodySize) {
+                            // reject before the body is read
+                            throw http::RequestError(413, "Request body too large");
+                        }
+                    }
+
+                    if (headerLength == std::string::npos && data.size() > this->requestLimits.maxHeaderSize)
+                        throw http::RequestError(431, "Request header too large");
+
+                    if (upload == nullptr && headerLength != std::string::npos && data.size() - headerLength > this->requestLimits.maxBodySize)
+                        throw http::RequestError(413, "Request body too large");
+                }
+
+                // the length of the body is known, read until it is complete
+                if (contentLength != std::string::npos) {
+                    if ((upload != nullptr ? uploaded : data.size() - headerLength) >= contentLength)
+                        break;
+                    continue;
+                }
+
+                // detect end of request
+                if(buffer[n-1] == '\n')
+                    break;
+                
+                // detect end of request if no \n is found
+                if(n!=bufferSize) 
+                    break;
+            }
+        } catch (const http::RequestError& e) {
+            rejectStatus = e.StatusCode();
+        } catch (...) {
+            // an upload callback of the endpoint or writing a part to its file failed
+            rejectStatus = 500;
         }
 
-        if (data.size() > 0) {
-            const http::Request req = http::parseHTTPRequest(data);
-            const http::Response res = this->processHTTPRequest(req);
+        receiving.end();
+
+        const bool streamed = upload != nullptr;
 
-            const std::string response = http::serializeHTTPResponse(res);
-            tcp::send(response, info->Socket())->join();
+        if (rejectStatus == 0 && std::chrono::steady_clock::now() >= deadline) {
+            const bool incomplete = headerLength == std::string::npos
+                || (contentLength != std::string::npos && (streamed ? uploaded : data.size() - headerLength) < contentLength);
+
+            if (incomplete)
+                rejectStatus = 408;
+        }
+
+        if (streamed) {
+            // the body ended before the closing delimiter
+            if (rejectStatus == 0 && ! upload->done())
+                rejectStatus = 400;
+
+            delete upload;
+        }
+
+        std::shared_ptr<const http::SerializedResponse> response;
+        http::Request req;
+        const auto handleStart = std::chrono::steady_clock::now();
+
+        if (rejectStatus != 0) {
+            req = head;
+            response = std::make_shared<const http::SerializedResponse>(http::serializeHTTPResponseParts(errorResponse(rejectStatus)));
+        } else if (data.size() > 0) {
+            tracing::Span parsing(tracing::PHASE::PARSE);
+            req = streamed ? head : http::parseHTTPRequest(data);
+            parsing.end();
+
+            if (this->tracer != nullptr)
+                tracing::setPath(trace, req.header.Path);
+
+            WorkerContext* context = this->acquireWorkerContext();
+
+            try {
+                response = this->handleHTTPRequest(req, *context);
+            } catch (...) {
+                this->releaseWorkerContext(context);
+                throw;
+            }
+
+            this->releaseWorkerContext(context);
+        }
+
+        if (response != nullptr) {
+            const auto writeStart = std::chrono::steady_clock::now();
+
+            tracing::Span writing(tracing::PHASE::WRITE);
+            tcp::sendv({ response->header, response->body, response->trailer }, info->Socket());
+            writing.end();
+
+            // the client may still be sending the rejected request
+            if (rejectStatus != 0)
+                discardRemainingRequest(info->Socket());
+
+            if (this->accessLog != nullptr && this->accessLog->sample()) {
+                const auto writeEnd = std::chrono::steady_clock::now();
+                const auto elapsed = [](auto from, auto to) { return (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(to - from).count(); };
+
+                AccessLog::Record record;
+                record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(receivedAt.time_since_epoch()).count();
+                AccessLog::setPeer(record, info->Address());
+                record.method = req.header.Method;
+                record.statusCode = statusCodeOf(response->header);
+                record.bytes = response->size();
+                AccessLog::setPath(record, req.header.Path);
+                record.receiveUs = elapsed(receiveStart, handleStart);
+                record.handleUs = elapsed(handleStart, writeStart);
+                record.writeUs = elapsed(writeStart, writeEnd);
+
+                this->accessLog->push(record);
+            }
         }
     }
 
+    receiving.end();
+
+    if (this->tracer != nullptr) {
+        tracing::attach(nullptr);
+        this->tracer->record(trace);
+    }
+
     info->stop();
     close(info->Socket());
+
+    {
+        std::lock_guard<std::mutex> lock(connectionFinished_mutex);
+        this->activeConnections--;
+    }
+    this->connectionFinished.notify_one();
 }
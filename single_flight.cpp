@@ -0,0 +1,38 @@
+#include "h/single_flight.h"
+
+
+std::shared_ptr<const http::SerializedResponse> SingleFlight::run(const std::string& key, const std::function<http::SerializedResponse()>& fn) {
+    std::promise<std::shared_ptr<const http::SerializedResponse>> promise;
+    Result result;
+    bool leader = false;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _inFlight.find(key);
+
+        if (it != _inFlight.end()) {
+            result = it->second;
+        } else {
+            result = promise.get_future().share();
+            _inFlight.emplace(key, result);
+            leader = true;
+        }
+    }
+
+    // an identical call is already running, wait for its result
+    if (! leader)
+        return result.get();
+
+    try {
+        promise.set_value(std::make_shared<const http::SerializedResponse>(fn()));
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _inFlight.erase(key);
+    }
+
+    return result.get();
+}
@@ -1,77 +1,357 @@
 #include "h/tcp.h"
 #include <iostream>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <chrono>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <algorithm>
+#include <arpa/inet.h>
 
 
-void tcp::openListener(const int port, const int maxConnections, void (*messageHandler)(const sockaddr_in, HTTPServer*, const int), HTTPServer* obj, std::atomic_bool& running) {
+tcp::ListenAddress tcp::ipv4Address(const int port, const std::string& host) {
+    ListenAddress address;
+    address.family = FAMILY::IPV4;
+    address.port = port;
+    address.host = host;
+    return address;
+}
+
+tcp::ListenAddress tcp::ipv6Address(const int port, const bool v6Only, const std::string& host) {
+    ListenAddress address;
+    address.family = FAMILY::IPV6;
+    address.port = port;
+    address.v6Only = v6Only;
+    address.host = host;
+    return address;
+}
+
+tcp::ListenAddress tcp::unixAddress(const std::string& path, const mode_t permissions) {
+    ListenAddress address;
+    address.family = FAMILY::UNIX;
+    address.path = path;
+    address.permissions = permissions;
+    return address;
+}
+
+/// @brief Sets an integer socket option, failures are only reported since tuning is best effort
+static void setOption(const int fd, const int level, const int option, const int value, const char* name) {
+    if (setsockopt(fd, level, option, &value, sizeof(value)) < 0)
+        perror(name);
+}
+
+/// @brief Checks if the path is free or a socket nobody listens on anymore
+/// @return true if the path does not exist or a connect to the socket is refused
+static bool isStaleSocket(const std::string& path, const sockaddr_storage& address) {
+    struct stat st;
+
+    if (lstat(path.c_str(), &st) < 0)
+        return errno == ENOENT;
+
+    if (! S_ISSOCK(st.st_mode))
+        return false;
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+
+    const bool refused = connect(fd, (const sockaddr*) &address, sizeof(sockaddr_un)) < 0 && errno == ECONNREFUSED;
+    close(fd);
+
+    return refused;
+}
+
+int tcp::bindListener(const ListenAddress& listenAddress, const SocketProfile& profile) {
     int serverFd;
-    struct sockaddr_in address;
     const int opt = 1;
-  
+
+    sockaddr_storage address = {};
+    socklen_t addressLength = 0;
+
+    switch (listenAddress.family) {
+    case FAMILY::IPV4: {
+        sockaddr_in* in = (sockaddr_in*) &address;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(listenAddress.port);
+        in->sin_addr.s_addr = INADDR_ANY;
+
+        if (! listenAddress.host.empty() && inet_pton(AF_INET, listenAddress.host.c_str(), &in->sin_addr) != 1) {
+            std::cerr << "invalid IPv4 address '" << listenAddress.host << "'" << std::endl;
+            return -1;
+        }
+
+        addressLength = sizeof(sockaddr_in);
+        break;
+    }
+    case FAMILY::IPV6: {
+        sockaddr_in6* in6 = (sockaddr_in6*) &address;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(listenAddress.port);
+        in6->sin6_addr = in6addr_any;
+
+        if (! listenAddress.host.empty() && inet_pton(AF_INET6, listenAddress.host.c_str(), &in6->sin6_addr) != 1) {
+            std::cerr << "invalid IPv6 address '" << listenAddress.host << "'" << std::endl;
+            return -1;
+        }
+
+        addressLength = sizeof(sockaddr_in6);
+        break;
+    }
+    case FAMILY::UNIX: {
+        sockaddr_un* un = (sockaddr_un*) &address;
+        un->sun_family = AF_UNIX;
+
+        if (listenAddress.path.empty() || listenAddress.path.size() >= sizeof(un->sun_path)) {
+            std::cerr << "invalid unix socket path '" << listenAddress.path << "'" << std::endl;
+            return -1;
+        }
+
+        strncpy(un->sun_path, listenAddress.path.c_str(), sizeof(un->sun_path) - 1);
+        addressLength = sizeof(sockaddr_un);
+
+        // remove a stale socket file of a previous run, but never a regular file or the socket of a running server
+        if (! isStaleSocket(listenAddress.path, address)) {
+            std::cerr << "unix socket path '" << listenAddress.path << "' is in use" << std::endl;
+            return -1;
+        }
+
+        unlink(listenAddress.path.c_str());
+        break;
+    }
+    }
+
     // Creating socket file descriptor
-    if ((serverFd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    if ((serverFd = socket(address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
         perror("socket failed");
-        exit(EXIT_FAILURE);
+        return -1;
     }
-  
+
     // Setting socket options
-    if (setsockopt(serverFd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
+    if (listenAddress.family != FAMILY::UNIX && (setsockopt(serverFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) || setsockopt(serverFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)))) {
         perror("setsockopt");
-        exit(EXIT_FAILURE);
+        close(serverFd);
+        return -1;
     }
 
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
-  
-    // attaching socket to the specified port
-    if (bind(serverFd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    // must be set before listen() to take effect on the window scaling of accepted connections
+    if (profile.receiveBufferSize > 0)
+        setOption(serverFd, SOL_SOCKET, SO_RCVBUF, profile.receiveBufferSize, "setsockopt SO_RCVBUF");
+
+    if (listenAddress.family != FAMILY::UNIX) {
+        if (profile.deferAcceptSeconds > 0)
+            setOption(serverFd, IPPROTO_TCP, TCP_DEFER_ACCEPT, profile.deferAcceptSeconds, "setsockopt TCP_DEFER_ACCEPT");
+
+#ifdef TCP_FASTOPEN
+        if (profile.fastOpenQueue > 0)
+            setOption(serverFd, IPPROTO_TCP, TCP_FASTOPEN, profile.fastOpenQueue, "setsockopt TCP_FASTOPEN");
+#endif
+    }
+
+    if (listenAddress.family == FAMILY::IPV6) {
+        const int v6Only = listenAddress.v6Only ? 1 : 0;
+
+        if (setsockopt(serverFd, IPPROTO_IPV6, IPV6_V6ONLY, &v6Only, sizeof(v6Only))) {
+            perror("setsockopt IPV6_V6ONLY");
+            close(serverFd);
+            return -1;
+        }
+    }
+
+    // attaching socket to the specified address
+    if (bind(serverFd, (struct sockaddr*)&address, addressLength) < 0) {
         perror("bind failed");
-        exit(EXIT_FAILURE);
+        close(serverFd);
+        return -1;
+    }
+
+    if (listenAddress.family == FAMILY::UNIX && chmod(listenAddress.path.c_str(), listenAddress.permissions) < 0) {
+        perror("chmod");
+        close(serverFd);
+        return -1;
     }
 
-    if (listen(serverFd, maxConnections) < 0) {
+    if (listen(serverFd, profile.backlog) < 0) {
         perror("listen");
-        exit(EXIT_FAILURE);
+        close(serverFd);
+        return -1;
+    }
+
+    return serverFd;
+}
+
+/// @brief Applies the per connection options of the profile to an accepted socket
+static void tuneConnection(const int socket, const int family, const tcp::SocketProfile& profile) {
+    if (family == AF_UNIX)
+        return;
+
+    if (profile.noDelay)
+        setOption(socket, IPPROTO_TCP, TCP_NODELAY, 1, "setsockopt TCP_NODELAY");
+
+    if (profile.sendBufferSize > 0)
+        setOption(socket, SOL_SOCKET, SO_SNDBUF, profile.sendBufferSize, "setsockopt SO_SNDBUF");
+
+#ifdef SO_BUSY_POLL
+    if (profile.busyPollMicroseconds > 0)
+        setOption(socket, SOL_SOCKET, SO_BUSY_POLL, profile.busyPollMicroseconds, "setsockopt SO_BUSY_POLL");
+#endif
+}
+
+void tcp::serveListeners(const std::vector<int>& listeners, const SocketProfile& profile, void (*messageHandler)(const sockaddr_storage&, HTTPServer*, const int), bool (*capacityHandler)(HTTPServer*), HTTPServer* obj, std::atomic_bool& running) {
+    std::vector<pollfd> fds;
+
+    for (const int listener : listeners) {
+        // listeners may be shared with other processes, a blocking accept could hang after another one took the connection
+        fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+        fds.push_back({ listener, POLLIN, 0 });
     }
 
     while (running) {
-        int newSocket;
-        struct sockaddr_in clientAddress;
-        int addrLen = sizeof(clientAddress);
-        
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 50 * 1000;
-
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(serverFd, &read_fds);
-
-        const int select_ret = select(serverFd + 1, &read_fds, NULL, NULL, &tv);
-
-        if (select_ret == -1) {
-            exit(EXIT_FAILURE);
-        } else if (select_ret == 0) {
+        // at capacity, leave the pending connections in the backlog
+        if (! capacityHandler(obj))
             continue;
-        } else {
-            if ((newSocket = accept(serverFd, (struct sockaddr*)&clientAddress, (socklen_t*)&addrLen)) < 0) {
-                perror("accept");
-                exit(EXIT_FAILURE);
+
+        const int poll_ret = poll(fds.data(), fds.size(), 50);
+
+        if (poll_ret == -1) {
+            if (errno != EINTR)
+                perror("poll");
+            continue;
+        } else if (poll_ret == 0) {
+            continue;
+        }
+
+        for (pollfd& fd : fds) {
+            if (! (fd.revents & POLLIN))
+                continue;
+
+            // drain the pending connections in one wakeup while there is capacity for them
+            while (running && capacityHandler(obj)) {
+                struct sockaddr_storage clientAddress;
+                socklen_t addrLen = sizeof(clientAddress);
+
+                const int newSocket = accept4(fd.fd, (struct sockaddr*)&clientAddress, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+                if (newSocket < 0) {
+                    // no more pending connections or they were taken by another process
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        break;
+
+                    // the connection was aborted by the client
+                    if (errno == EINTR || errno == ECONNABORTED)
+                        continue;
+
+                    perror("accept");
+
+                    // out of file descriptors or memory, back off instead of spinning
+                    if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+                    break;
+                }
+
+                tuneConnection(newSocket, clientAddress.ss_family, profile);
+                messageHandler(clientAddress, obj, newSocket);
             }
+        }
+    }
+}
 
-            messageHandler(clientAddress, obj, newSocket);
+std::vector<int> tcp::bindListeners(const std::vector<ListenAddress>& addresses, const SocketProfile& profile) {
+    std::vector<int> fds;
+
+    for (size_t i = 0; i < addresses.size(); i++) {
+        const int fd = bindListener(addresses[i], profile);
+
+        if (fd < 0) {
+            // all or nothing, release the listeners created so far
+            closeListeners(fds, addresses);
+            return {};
         }
+
+        fds.push_back(fd);
     }
 
-    shutdown(serverFd, SHUT_RDWR);
+    return fds;
+}
+
+void tcp::closeListeners(const std::vector<int>& fds, const std::vector<ListenAddress>& addresses) {
+    for (size_t i = 0; i < fds.size(); i++) {
+        shutdown(fds[i], SHUT_RDWR);
+        close(fds[i]);
+
+        if (i < addresses.size() && addresses[i].family == FAMILY::UNIX)
+            unlink(addresses[i].path.c_str());
+    }
+}
+
+bool tcp::openListener(const std::vector<ListenAddress>& addresses, const SocketProfile& profile, void (*messageHandler)(const sockaddr_storage&, HTTPServer*, const int), bool (*capacityHandler)(HTTPServer*), HTTPServer* obj, std::atomic_bool& running) {
+    const std::vector<int> fds = bindListeners(addresses, profile);
+
+    if (fds.empty() && ! addresses.empty())
+        return false;
+
+    serveListeners(fds, profile, messageHandler, capacityHandler, obj, running);
+    closeListeners(fds, addresses);
+
+    return true;
 }
 
 std::thread* tcp::send(const std::string msg, const int socket) {
     return new std::thread([msg, socket]() {
-        write(socket, msg.c_str(), msg.size());
+        sendv({ msg }, socket);
     });
 }
 
-int tcp::rcv(const int socket, char* buffer, const int n) {
-    return read(socket, buffer, n);
+bool tcp::sendv(const std::vector<std::string_view>& parts, const int socket) {
+    std::vector<iovec> iov;
+
+    for (const std::string_view& part : parts)
+        if (! part.empty())
+            iov.push_back({ (void*) part.data(), part.size() });
+
+    size_t next = 0;
+
+    while (next < iov.size()) {
+        const ssize_t n = writev(socket, iov.data() + next, std::min(iov.size() - next, (size_t) IOV_MAX));
+
+        if (n >= 0) {
+            // skip the parts written completely and continue inside the partially written one
+            size_t written = n;
+
+            while (next < iov.size() && written >= iov[next].iov_len)
+                written -= iov[next++].iov_len;
+
+            if (next < iov.size()) {
+                iov[next].iov_base = (char*) iov[next].iov_base + written;
+                iov[next].iov_len -= written;
+            }
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // the socket is non-blocking, wait until the send buffer has room again
+            pollfd fd = { socket, POLLOUT, 0 };
+            if (poll(&fd, 1, 5000) <= 0)
+                return false;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int tcp::rcv(const int socket, char* buffer, const int n, const int timeoutMs) {
+    while (true) {
+        const int received = read(socket, buffer, n);
+
+        if (received >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            return received;
+
+        // the socket is non-blocking, wait shortly for more data
+        if (errno != EINTR) {
+            pollfd fd = { socket, POLLIN, 0 };
+            if (poll(&fd, 1, timeoutMs) <= 0)
+                return 0;
+        }
+    }
 }
@@ -0,0 +1,198 @@
+#include "h/tracing.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+static thread_local tracing::Trace* currentTrace = nullptr;
+
+static size_t roundUpToPowerOfTwo(size_t n) {
+    size_t result = 2;
+    while (result < n)
+        result <<= 1;
+    return result;
+}
+
+std::string tracing::PHASE_toString(PHASE phase) {
+    switch (phase) {
+    case PHASE::DISPATCH:
+        return "dispatch";
+    case PHASE::RECEIVE:
+        return "receive";
+    case PHASE::PARSE:
+        return "parse";
+    case PHASE::ROUTE:
+        return "route";
+    case PHASE::CALLBACK:
+        return "callback";
+    case PHASE::SERIALIZE:
+        return "serialize";
+    case PHASE::WRITE:
+        return "write";
+    default:
+        return "unknown";
+    }
+}
+
+void tracing::attach(Trace* trace) {
+    if (trace != nullptr)
+        trace->tid = gettid();
+
+    currentTrace = trace;
+}
+
+tracing::Trace* tracing::current() {
+    return currentTrace;
+}
+
+void tracing::setPath(Trace& trace, const std::string& path) {
+    const size_t n = path.size() < PATH_LENGTH - 1 ? path.size() : PATH_LENGTH - 1;
+    memcpy(trace.path, path.data(), n);
+    trace.path[n] = '\0';
+}
+
+tracing::Tracer::Tracer(const Options& options):
+    _options(options),
+    _sampled(roundUpToPowerOfTwo(options.capacity)),
+    _slow(roundUpToPowerOfTwo(options.slowCapacity)),
+    _sampledHead(0),
+    _slowHead(0),
+    _counter(0) {
+
+    for (Slot& slot : _sampled)
+        slot.sequence.store(0, std::memory_order_relaxed);
+    for (Slot& slot : _slow)
+        slot.sequence.store(0, std::memory_order_relaxed);
+}
+
+void tracing::Tracer::store(std::vector<Slot>& ring, std::atomic<uint64_t>& head, const Trace& trace) {
+    Slot& slot = ring[head.fetch_add(1, std::memory_order_relaxed) & (ring.size() - 1)];
+    uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+
+    // another thread is writing this slot, the ring wrapped around
+    if ((sequence & 1) || ! slot.sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire))
+        return;
+
+    slot.trace = trace;
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void tracing::Tracer::record(const Trace& trace) {
+    uint64_t first = 0, last = 0;
+
+    for (size_t i = 0; i < (size_t) PHASE::COUNT; i++) {
+        if (trace.begin[i] != 0 && (first == 0 || trace.begin[i] < first))
+            first = trace.begin[i];
+        if (trace.end[i] > last)
+            last = trace.end[i];
+    }
+
+    if (_options.slowThresholdUs > 0 && last - first >= _options.slowThresholdUs * 1000) {
+        store(_slow, _slowHead, trace);
+        return;
+    }
+
+    if (_options.sampleRate <= 1 || _counter.fetch_add(1, std::memory_order_relaxed) % _options.sampleRate == 0)
+        store(_sampled, _sampledHead, trace);
+}
+
+/// @brief Returns the length of the valid UTF-8 sequence at c or 0 if it is invalid
+static size_t utf8SequenceLength(const unsigned char* c) {
+    size_t length;
+    uint32_t codepoint;
+
+    if (c[0] >= 0xc2 && c[0] <= 0xdf) {
+        length = 2;
+        codepoint = c[0] & 0x1f;
+    } else if (c[0] >= 0xe0 && c[0] <= 0xef) {
+        length = 3;
+        codepoint = c[0] & 0x0f;
+    } else if (c[0] >= 0xf0 && c[0] <= 0xf4) {
+        length = 4;
+        codepoint = c[0] & 0x07;
+    } else {
+        return 0;
+    }
+
+    // the terminating zero fails this check, so a sequence cut off by the path length is invalid
+    for (size_t i = 1; i < length; i++) {
+        if ((c[i] & 0xc0) != 0x80)
+            return 0;
+        codepoint = (codepoint << 6) | (c[i] & 0x3f);
+    }
+
+    // overlong encodings, surrogates and code points beyond U+10FFFF
+    if ((length == 3 && codepoint < 0x800) || (length == 4 && codepoint < 0x10000) || (codepoint >= 0xd800 && codepoint <= 0xdfff) || codepoint > 0x10ffff)
+        return 0;
+
+    return length;
+}
+
+/// @brief Appends the path as a JSON string, control characters and bytes that are not valid UTF-8 are escaped as \u00XX
+static void appendJsonString(std::string& out, const char* value) {
+    out += '"';
+    for (const unsigned char* c = (const unsigned char*) value; *c != '\0';) {
+        const size_t length = *c >= 0x80 ? utf8SequenceLength(c) : 0;
+
+        if (*c == '"' || *c == '\\') {
+            out += '\\';
+            out += (char) *c++;
+        } else if (*c >= 0x20 && *c < 0x80) {
+            out += (char) *c++;
+        } else if (length > 0) {
+            out.append((const char*) c, length);
+            c += length;
+        } else {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", *c++);
+            out += escaped;
+        }
+    }
+    out += '"';
+}
+
+void tracing::Tracer::dump(const std::vector<Slot>& ring, const uint64_t since, const char* category, std::string& out, bool& first) {
+    const int pid = getpid();
+    char event[256];
+
+    for (const Slot& slot : ring) {
+        const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence == 0 || (sequence & 1))
+            continue;
+
+        const Trace trace = slot.trace;
+
+        // the slot was overwritten while copying
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+            continue;
+
+        for (size_t i = 0; i < (size_t) PHASE::COUNT; i++) {
+            if (trace.begin[i] == 0 || trace.end[i] < trace.begin[i] || trace.end[i] < since)
+                continue;
+
+            snprintf(event, sizeof(event), "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"path\":",
+                first ? "" : ",", PHASE_toString((PHASE) i).c_str(), category,
+                trace.begin[i] / 1000.0, (trace.end[i] - trace.begin[i]) / 1000.0, pid, trace.tid);
+
+            out += event;
+            appendJsonString(out, trace.path);
+            out += "}}";
+            first = false;
+        }
+    }
+}
+
+std::string tracing::Tracer::dumpChromeTrace(const unsigned int seconds) const {
+    const uint64_t window = (uint64_t) seconds * 1000000000ull;
+    const uint64_t time = now();
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+
+    dump(_sampled, time > window ? time - window : 0, "sampled", out, first);
+    dump(_slow, 0, "slow", out, first);
+
+    out += "]}";
+    return out;
+}
@@ -0,0 +1,35 @@
+#include "h/worker_context.h"
+
+
+WorkerContext::WorkerContext(const size_t id, const std::vector<std::function<std::shared_ptr<void>()>>& factories):
+    _id(id), _hasMessages(false) {
+
+    for (const auto& factory : factories)
+        _slots.push_back(factory());
+}
+
+void WorkerContext::post(const std::string& message) {
+    std::lock_guard<std::mutex> lock(_inboxMutex);
+    _inbox.push_back(message);
+    _hasMessages = true;
+}
+
+void WorkerContext::deliver(const std::function<void(WorkerContext&, const std::string&)>& handler) {
+    // fast path, no locking if nothing was posted
+    if (! _hasMessages)
+        return;
+
+    std::vector<std::string> messages;
+
+    {
+        std::lock_guard<std::mutex> lock(_inboxMutex);
+        messages.swap(_inbox);
+        _hasMessages = false;
+    }
+
+    if (! handler)
+        return;
+
+    for (const std::string& message : messages)
+        handler(*this, message);
+}